@@ -1,11 +1,19 @@
+#include <charconv>
 #include <cinttypes>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <format>
 #include <iostream>
+#include <memory>
 #include "args.hxx"
 #include "fastx.hpp"
+#include "fastx-reader.hpp"
+#include "fxi.hpp"
+#include "fastx-writer.hpp"
+#include "perf-counters.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
@@ -14,23 +22,27 @@ static const char* PROLOGUE = "";
 static const char* EPILOGUE = "";
 
 /* I/O variables */
-static char* in_buf;
-static char* out_buf;
+static unique_ptr<FastxWriter> writer;
 
 /* Argument variables */
+static string trace_path;
+static bool perf_counters = false;
 static size_t in_buf_size = 32768;
+
+static bool build_index = false;
+static size_t index_interval = FXI_INTERVAL;
+static uint64_t skip_count = 0;
+static bool count_only = false;
 static size_t out_buf_size = 32768;
+static size_t num_out_bufs = NUM_OUT_BUFS;
 
 static bool keep_n_nuc_seq = false;
 static bool rename_seq_id = false;
 
 /* libfastx variables */
 static FastxContext_t fastx_ctx;
-static FastxRecord_t fastx_record;
 
 /* internal variables */
-static uint64_t out_buf_pos = 0;
-static string rec_buf;
 static size_t total_bytes_written = 0;
 
 void valid_args()
@@ -39,7 +51,11 @@ void valid_args()
 
 	result &= in_buf_size > 0 && out_buf_size > 0;
 	result &= fastx_ctx.max_seq_len > 0;
-	result &= in_buf_size >= fastx_ctx.max_seq_len;
+	result &= fastx_ctx.num_in_bufs >= 2;
+	result &= !build_index || (index_interval > 0 && strlen(fastx_ctx.in_name) > 0);
+	result &= !build_index || skip_count == 0; // The index needs every record
+	result &= num_out_bufs >= 2;
+	result &= fastx_ctx.long_reads || in_buf_size >= fastx_ctx.max_seq_len;
 
 	if (!result)
 		throw invalid_argument("Invalid arguments");
@@ -55,23 +71,50 @@ void parse_args(int argc, char** argv)
 	args::Flag keep_n_nuc_seq_arg(parser, "n", format("keep sequence with unknown (N) nucleotides. default is {}", keep_n_nuc_seq), { 'n' }, keep_n_nuc_seq);
 	args::Flag rn_sqid_arg(parser, "r", format("rename sequence id. default is {}", rename_seq_id), { 'r' }, rename_seq_id);
 
+	args::Group index_group(parser, "Index");
+	args::Flag fxi_arg(index_group, "fxi", "write a record offset index next to the input file (<in>.fxi) while reading", { "fxi" }, build_index);
+	args::ValueFlag<size_t> fxik_arg(index_group, "fxik", format("records between index entries. default is {}", index_interval), { "fxik" }, index_interval);
+	args::ValueFlag<uint64_t> skip_arg(index_group, "skip", "skip the first records. seeks with an up-to-date <in>.fxi. default is 0", { "skip" }, skip_count);
+	args::Flag count_arg(index_group, "count", "write the number of records instead of sequences. read from an up-to-date <in>.fxi. default is false", { "count" }, count_only);
+
 	args::Group io_tuning_group(parser, "I/O Tuning");
 	args::ValueFlag<size_t> ibufs_arg(io_tuning_group, "ibufs", format("input buffer size. default is {}", in_buf_size), { "ibufs" }, in_buf_size);
+	args::ValueFlag<size_t> ibufn_arg(io_tuning_group, "ibufn", format("number of input buffers read ahead in the background. default is {}", fastx_ctx.num_in_bufs), { "ibufn" }, fastx_ctx.num_in_bufs);
 	args::ValueFlag<size_t> obufs_arg(io_tuning_group, "obufs", format("output buffer size. default is {}", out_buf_size), { "obufs" }, out_buf_size);
+	args::ValueFlag<size_t> obufn_arg(io_tuning_group, "obufn", format("number of output buffers written in the background. default is {}", num_out_bufs), { "obufn" }, num_out_bufs);
 	args::ValueFlag<size_t> mxsl_arg(io_tuning_group, "mxsl", format("maximum sequence length. default is {}", fastx_ctx.max_seq_len), { "mxsl" }, fastx_ctx.max_seq_len);
+	args::Flag long_arg(io_tuning_group, "long", "long-read mode: no max sequence length, records may span input buffers. default is false", { "long" }, fastx_ctx.long_reads);
+	args::MapFlag<string, IoMode> io_arg(io_tuning_group, "io", "input mode: mmap or read. mmap falls back to read for pipes. default is mmap", { "io" }, {
+	{ "mmap", IoMode::IO_MODE_MMAP },
+	{ "read", IoMode::IO_MODE_READ } }, fastx_ctx.io_mode);
+
+	args::Group diag_group(parser, "Diagnostics");
+	args::ValueFlag<string> trace_arg(diag_group, "trace", "write a Chrome trace JSON timeline to the file", { "trace" }, trace_path);
+	args::Flag perf_arg(diag_group, "perf-counters", "print hardware counters per processing stage to STDERR. default is false", { "perf-counters" }, perf_counters);
 
 	try
 	{
 		parser.ParseCLI(argc, argv);
+		trace_path = args::get(trace_arg);
+		perf_counters = perf_arg;
 
 		args::get(in_arg).copy(fastx_ctx.in_name, MAX_PATH, 0);
 		args::get(out_arg).copy(fastx_ctx.out_name, MAX_PATH, 0);
 		keep_n_nuc_seq = args::get(keep_n_nuc_seq_arg);
 		rename_seq_id = args::get(rn_sqid_arg);
 
+		build_index = fxi_arg;
+		index_interval = args::get(fxik_arg);
+		skip_count = args::get(skip_arg);
+		count_only = count_arg;
+
 		in_buf_size = args::get(ibufs_arg);
+		fastx_ctx.num_in_bufs = args::get(ibufn_arg);
 		out_buf_size = args::get(obufs_arg);
+		num_out_bufs = args::get(obufn_arg);
 		fastx_ctx.max_seq_len = args::get(mxsl_arg);
+		fastx_ctx.long_reads = long_arg;
+		fastx_ctx.io_mode = args::get(io_arg);
 
 		valid_args();
 	}
@@ -84,120 +127,84 @@ void parse_args(int argc, char** argv)
 	}
 }
 
-void alloc_bufs()
-{
-	in_buf = new char[in_buf_size];
-	out_buf = new char[out_buf_size];
-
-	memset(&fastx_record, 0, sizeof(FastxRecord_t));
-	fastx_record.seq_id = new char[fastx_ctx.max_seq_len];
-	fastx_record.seq = new char[fastx_ctx.max_seq_len];
-
-	rec_buf.reserve(MAX_SEQUENCE_LENGTH * RECORD_MEMBER_COUNTS[static_cast<uint8_t>(FileFormat::FILE_FORMAT_FASTA)] + 2);
-}
-
-void free_bufs()
-{
-	if (in_buf) delete[] in_buf;
-	if (out_buf) delete[] out_buf;
-
-	if (fastx_record.seq_id) delete[] fastx_record.seq_id;
-	if (fastx_record.seq) delete[] fastx_record.seq;
-}
-
 void open_files()
 {
 	open_file(fastx_ctx.in_name, "rb", &fastx_ctx.in_stream);
-	fastx_ctx.format = get_file_format(fastx_ctx.in_stream);
+	open_input(&fastx_ctx);
+
+	if (build_index)
+		fastx_ctx.index.reset(new FxiIndex(index_interval));
 
 	open_file(fastx_ctx.out_name, "wb", &fastx_ctx.out_stream);
+	writer = make_unique<FastxWriter>(fastx_ctx.out_stream, out_buf_size, num_out_bufs);
 }
 
 void close_files()
 {
-	close_file(fastx_ctx.in_stream);
-	close_file(fastx_ctx.out_stream);
-}
+	close_input(&fastx_ctx);
 
-void flush_out_buf()
-{
-	fwrite(out_buf, sizeof(char), out_buf_pos, fastx_ctx.out_stream);
-	out_buf_pos = 0;
+	writer->flush();
+	writer.reset();
+	close_file(fastx_ctx.out_stream);
 }
 
-void write_rec(const string& rec)
+void process_record(const FastxRecordView_t& record)
 {
-	size_t curr_pos = 0;
-	size_t remaining_size = rec.size();
+	if (!keep_n_nuc_seq && memchr(record.seq, 'N', record.seq_len) != NULL)
+		return;
 
-	while (remaining_size > 0)
+	if (rename_seq_id)
 	{
-		size_t copy_size = remaining_size <= out_buf_size ? remaining_size : out_buf_size;
-
-		if (copy_size + out_buf_pos >= out_buf_size)
-			copy_size = out_buf_size - out_buf_pos;
-
-		copy(rec.begin() + curr_pos, rec.begin() + curr_pos + copy_size, out_buf + out_buf_pos);
+		char seq_num[24];
+		to_chars_result result = to_chars(seq_num, seq_num + sizeof(seq_num), total_bytes_written + 1);
 
-		remaining_size = remaining_size >= copy_size ? remaining_size - copy_size : copy_size - remaining_size;
-		out_buf_pos += copy_size;
-		curr_pos += copy_size;
-
-		if (out_buf_pos == out_buf_size)
-			flush_out_buf();
+		writer->write(seq_num, result.ptr - seq_num);
 	}
-}
-
-void append_line_break(string& str)
-{
-	str += LINE_FEED;
-}
-
-void process_record(FastxRecord_t* record, size_t record_idx)
-{
-	if (!keep_n_nuc_seq && strchr(record->seq, 'N') != NULL)
-		return;
-
-	if (rename_seq_id)
-		rec_buf += to_string(total_bytes_written + 1);
 	else
 	{
-		rec_buf += FILE_SIGNATURES[static_cast<uint8_t>(FileFormat::FILE_FORMAT_FASTA)]; // Append FASTA signature
-		rec_buf += record->seq_id + 1; // Skip FASTQ signature
-		append_line_break(rec_buf);
+		writer->put(FILE_SIGNATURES[static_cast<uint8_t>(FileFormat::FILE_FORMAT_FASTA)]); // Append FASTA signature
+		writer->write(record.seq_id + 1, record.seq_id_len - 1); // Skip FASTQ signature
+		writer->put(LINE_FEED);
 	}
 
-	rec_buf += record->seq;
-	append_line_break(rec_buf);
-
-	write_rec(rec_buf);
-	rec_buf.clear();
+	writer->write(record.seq, record.seq_len);
+	writer->put(LINE_FEED);
 
-	total_bytes_written += record->read_count;
+	total_bytes_written += record.read_count;
 }
 
 void read_records()
 {
-	size_t record_idx = 0; // FIXED: Receive only one record at each time.
-	DispatchResult_t result;
-	function<void(FastxRecord_t*, size_t)> callback = process_record;
-
 	if (fastx_ctx.format != FileFormat::FILE_FORMAT_FASTQ)
 		throw runtime_error("Invalid file format");
 
-	do
+	FxiIndex index;
+	bool has_index = !build_index && load_index(&index, fastx_ctx.in_name);
+	FastxReader reader(&fastx_ctx, in_buf_size);
+
+	if (count_only)
 	{
-		result = dispatch_records(
-			in_buf, in_buf_size,
-			result.num_rem_bytes,
-			&fastx_ctx,
-			&fastx_record,
-			&record_idx,
-			callback);
+		char num_buf[24];
+		uint64_t num_records = 0;
+
+		if (has_index)
+			num_records = index.get_num_records() - min(skip_count, index.get_num_records());
+		else
+		{
+			reader.skip_records(skip_count);
 
-	} while (result.num_proc_bytes);
+			while (size_t count = reader.next_batch().size())
+				num_records += count;
+		}
+
+		writer->write(num_buf, to_chars(num_buf, num_buf + sizeof(num_buf), num_records).ptr - num_buf);
+		writer->put(LINE_FEED);
+		return;
+	}
 
-	flush_out_buf();
+	reader.skip_records(skip_count, has_index ? &index : nullptr);
+
+	while (reader.next_batch(process_record));
 }
 
 int main(int argc, char** argv)
@@ -207,13 +214,24 @@ int main(int argc, char** argv)
 		ios::sync_with_stdio(false);
 		parse_args(argc, argv);
 
-		alloc_bufs();
+		if (!trace_path.empty())
+			trace_start();
+
+		if (perf_counters)
+			perf_start();
+
 		open_files();
 
 		read_records();
+		write_index(&fastx_ctx);
 
 		close_files();
-		free_bufs();
+
+		if (!trace_path.empty())
+			trace_write(trace_path);
+
+		if (perf_counters)
+			perf_report(stderr);
 	}
 	catch (const exception& e)
 	{
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "args.hxx"
+#include "column-stats.hpp"
+#include "fastx.hpp"
+#include "fastx-reader.hpp"
+#include "fastx-writer.hpp"
+#include "sample-gen.hpp"
+
+using namespace std;
+
+#ifdef _WIN32
+static const char* NULL_DEVICE = "NUL";
+#else
+static const char* NULL_DEVICE = "/dev/null";
+#endif
+
+static constexpr size_t SHORT_READ_LEN = 150;
+static constexpr size_t LONG_READ_LEN = 10000;
+static constexpr uint32_t DATA_SEED = 42;
+
+typedef struct Dataset_s
+{
+	string name;
+	FileFormat format;
+	LineBreak line_break;
+	size_t read_len;
+	string data;
+	size_t num_records;
+} Dataset_t;
+
+/* Argument parser constants */
+static const char* PROLOGUE = "Microbenchmarks of the libfastx parser, writer, statistics and generator kernels on synthetic in-memory data";
+static const char* EPILOGUE = "";
+
+/* Argument variables */
+static size_t num_reps = 10;
+static size_t data_size = 16; // MiB per dataset
+static string filter;
+
+/* internal variables */
+static volatile uint64_t sink = 0; // Keeps kernel results alive
+static FILE* null_fp = nullptr;
+
+void valid_args()
+{
+	bool result = true;
+
+	result &= num_reps > 0;
+	result &= data_size > 0;
+
+	if (!result)
+		throw invalid_argument("Invalid arguments");
+}
+
+void parse_args(int argc, char** argv)
+{
+	args::ArgumentParser parser(PROLOGUE, EPILOGUE);
+	args::HelpFlag help(parser, "help", "Display options", { 'h', "help" });
+
+	args::ValueFlag<size_t> reps_arg(parser, "reps", format("timed repetitions per benchmark. default is {}", num_reps), { "reps" }, num_reps);
+	args::ValueFlag<size_t> size_arg(parser, "size", format("synthetic data size in MiB. default is {}", data_size), { "size" }, data_size);
+	args::ValueFlag<string> filter_arg(parser, "filter", "run only benchmarks whose name contains the string", { "filter" }, filter);
+
+	try
+	{
+		parser.ParseCLI(argc, argv);
+
+		num_reps = args::get(reps_arg);
+		data_size = args::get(size_arg);
+		filter = args::get(filter_arg);
+
+		valid_args();
+	}
+	catch (const exception& e)
+	{
+		cout << parser << endl;
+		cerr << e.what() << endl;
+		exit(errno);
+	}
+}
+
+bool is_selected(const string& name)
+{
+	return filter.empty() || name.find(filter) != string::npos;
+}
+
+// Reports the median, minimum and standard deviation of num_reps timed runs after one warm-up run
+template <typename Kernel>
+void run_bench(const string& name, size_t bytes, size_t items, Kernel&& kernel)
+{
+	if (!is_selected(name))
+		return;
+
+	vector<double> times(num_reps);
+	double sum = 0, sq_sum = 0;
+
+	sink = sink + kernel();
+
+	for (double& time : times)
+	{
+		chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+		sink = sink + kernel();
+		time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+		sum += time;
+		sq_sum += time * time;
+	}
+
+	sort(times.begin(), times.end());
+
+	double median = num_reps % 2 ? times[num_reps / 2] : (times[num_reps / 2 - 1] + times[num_reps / 2]) / 2;
+	double mean = sum / num_reps;
+	double stddev = sqrt(max(sq_sum / num_reps - mean * mean, 0.0));
+
+	printf("%-36s %10.3f %10.3f %10.3f", name.c_str(), median * 1e3, times[0] * 1e3, stddev * 1e3);
+
+	if (bytes)
+		printf(" %12.1f", bytes / median / (1 << 20));
+	else
+		printf(" %12s", "-");
+
+	printf(" %12.3f\n", items / median / 1e6);
+}
+
+string get_dataset_name(FileFormat file_format, LineBreak line_break, size_t read_len)
+{
+	return format("{}/{}/{}", file_format == FileFormat::FILE_FORMAT_FASTA ? "fasta" : "fastq",
+		line_break == LineBreak::LINE_BREAK_CRLF ? "crlf" : "lf", read_len == SHORT_READ_LEN ? "short" : "long");
+}
+
+Dataset_t make_dataset(FileFormat file_format, LineBreak line_break, size_t read_len)
+{
+	Dataset_t dataset = { get_dataset_name(file_format, line_break, read_len), file_format, line_break, read_len, "", 0 };
+	mt19937 mt(DATA_SEED);
+	uniform_int_distribution<> nuc_dist(0, 63); // One base in 64 is N
+	uniform_int_distribution<> qual_dist(BASE_QUALITY_OFFSET + 2, BASE_QUALITY_OFFSET + 41);
+	const char* eol = line_break == LineBreak::LINE_BREAK_CRLF ? "\r\n" : "\n";
+
+	dataset.data.reserve((data_size << 20) + read_len * 3);
+
+	while (dataset.data.size() < data_size << 20)
+	{
+		dataset.data += FILE_SIGNATURES[static_cast<uint8_t>(file_format)];
+		dataset.data += format("read.{}", dataset.num_records);
+		dataset.data += eol;
+
+		for (size_t i = 0; i < read_len; ++i)
+		{
+			int nuc = nuc_dist(mt);
+			dataset.data += nuc == 0 ? 'N' : "ACGT"[nuc & 3];
+		}
+
+		dataset.data += eol;
+
+		if (file_format == FileFormat::FILE_FORMAT_FASTQ)
+		{
+			dataset.data += '+';
+			dataset.data += eol;
+
+			for (size_t i = 0; i < read_len; ++i)
+				dataset.data += static_cast<char>(qual_dist(mt));
+
+			dataset.data += eol;
+		}
+
+		dataset.num_records++;
+	}
+
+	return dataset;
+}
+
+FastxContext_t make_context(const Dataset_t& dataset)
+{
+	FastxContext_t ctx;
+
+	ctx.format = dataset.format;
+	ctx.line_break = dataset.line_break;
+
+	return ctx;
+}
+
+// The in-memory reader never repacks, so the views stay valid as long as the dataset
+vector<FastxRecordView_t> parse_records(const Dataset_t& dataset)
+{
+	FastxContext_t ctx = make_context(dataset);
+	FastxReader reader(&ctx, dataset.data.data(), dataset.data.size());
+	vector<FastxRecordView_t> records;
+
+	for (span<FastxRecordView_t> batch = reader.next_batch(); !batch.empty(); batch = reader.next_batch())
+		records.insert(records.end(), batch.begin(), batch.end());
+
+	return records;
+}
+
+void bench_parse(const Dataset_t& dataset)
+{
+	run_bench("parse/" + dataset.name, dataset.data.size(), dataset.num_records, [&dataset]()
+		{
+			FastxContext_t ctx = make_context(dataset);
+			FastxReader reader(&ctx, dataset.data.data(), dataset.data.size());
+			uint64_t num_records = 0;
+
+			for (span<FastxRecordView_t> batch = reader.next_batch(); !batch.empty(); batch = reader.next_batch())
+				num_records += batch.size();
+
+			return num_records;
+		});
+}
+
+void bench_stats(const Dataset_t& dataset, const vector<FastxRecordView_t>& records)
+{
+	ColumnStatsStore stats;
+	size_t num_bases = records.size() * dataset.read_len;
+	size_t num_queries = 0;
+
+	// Counts accumulate over the runs; only the histogram shape matters to get_nth_value
+	auto update = [&]()
+		{
+			for (const FastxRecordView_t& record : records)
+				stats.add_record(record, BASE_QUALITY_OFFSET);
+
+			return stats.get_count(0, ALL);
+		};
+
+	if (is_selected("add_record/" + dataset.name))
+		run_bench("add_record/" + dataset.name, num_bases, records.size(), update);
+	else
+		update();
+
+	if (dataset.format != FileFormat::FILE_FORMAT_FASTQ)
+		return;
+
+	for (size_t i = 0; i < stats.size(); ++i)
+		for (uint8_t j = 0; j < NUCLEOTIDE_COUNT; ++j)
+			num_queries += stats.get_count(i, j) ? 3 : 0;
+
+	// Includes deriving the statistics of each column from its counters
+	run_bench("get_nth_value/" + dataset.name, 0, num_queries, [&stats]()
+		{
+			NucleotideStatistics col_stats[NUCLEOTIDE_COUNT];
+			int64_t total = 0;
+
+			for (size_t i = 0; i < stats.size(); ++i)
+			{
+				stats.get_column_stats(i, col_stats);
+
+				for (const NucleotideStatistics& nuc_stats : col_stats)
+				{
+					if (nuc_stats.count == 0)
+						continue;
+
+					total += get_nth_value(nuc_stats, nuc_stats.count / 4, MIN_QUALITY);
+					total += get_nth_value(nuc_stats, nuc_stats.count / 2, MIN_QUALITY);
+					total += get_nth_value(nuc_stats, nuc_stats.count * 3 / 4, MIN_QUALITY);
+				}
+			}
+
+			return static_cast<uint64_t>(total);
+		});
+}
+
+// FASTA records as fastq-to-fasta writes them
+void bench_write(const Dataset_t& dataset, const vector<FastxRecordView_t>& records)
+{
+	FastxWriter writer(null_fp, 32768);
+	size_t num_bytes = 0;
+
+	for (const FastxRecordView_t& record : records)
+		num_bytes += record.seq_id_len + record.seq_len + 2;
+
+	run_bench("write/" + dataset.name, num_bytes, records.size(), [&]()
+		{
+			for (const FastxRecordView_t& record : records)
+			{
+				writer.put(FILE_SIGNATURES[static_cast<uint8_t>(FileFormat::FILE_FORMAT_FASTA)]);
+				writer.write(record.seq_id + 1, record.seq_id_len - 1);
+				writer.put(LINE_FEED);
+				writer.write(record.seq, record.seq_len);
+				writer.put(LINE_FEED);
+			}
+
+			writer.flush();
+
+			return writer.get_total_bytes_written();
+		});
+}
+
+void bench_gen()
+{
+	SampleRng rng(DATA_SEED, 0);
+	size_t num_records = (data_size << 20) / SHORT_READ_LEN;
+	size_t num_bytes = num_records * SHORT_READ_LEN;
+	vector<char> buf(num_bytes);
+
+	run_bench("gen/nucs", num_bytes, num_records, [&]()
+		{
+			for (size_t i = 0; i < num_records; ++i)
+				gen_rand_nucs(buf.data() + i * SHORT_READ_LEN, SHORT_READ_LEN, rng);
+
+			return static_cast<uint64_t>(buf[num_bytes - 1]);
+		});
+
+	run_bench("gen/quals", num_bytes, num_records, [&]()
+		{
+			for (size_t i = 0; i < num_records; ++i)
+				gen_rand_chars(buf.data() + i * SHORT_READ_LEN, SHORT_READ_LEN, rng, BASE_QUALITY_OFFSET - MIN_QUALITY, BASE_QUALITY_OFFSET + MAX_QUALITY);
+
+			return static_cast<uint64_t>(buf[num_bytes - 1]);
+		});
+}
+
+void run_benches()
+{
+	for (FileFormat file_format : { FileFormat::FILE_FORMAT_FASTA, FileFormat::FILE_FORMAT_FASTQ })
+	{
+		for (LineBreak line_break : { LineBreak::LINE_BREAK_LF, LineBreak::LINE_BREAK_CRLF })
+		{
+			for (size_t read_len : { SHORT_READ_LEN, LONG_READ_LEN })
+			{
+				string name = get_dataset_name(file_format, line_break, read_len);
+				bool is_lf = line_break == LineBreak::LINE_BREAK_LF;
+				bool is_lf_fastq = is_lf && file_format == FileFormat::FILE_FORMAT_FASTQ;
+				bool use_stats = (is_lf && is_selected("add_record/" + name)) || (is_lf_fastq && is_selected("get_nth_value/" + name));
+				bool use_write = is_lf_fastq && is_selected("write/" + name);
+
+				if (!is_selected("parse/" + name) && !use_stats && !use_write)
+					continue;
+
+				// Generated once per variant; only the kernels are timed
+				Dataset_t dataset = make_dataset(file_format, line_break, read_len);
+
+				bench_parse(dataset);
+
+				if (!use_stats && !use_write)
+					continue;
+
+				vector<FastxRecordView_t> records = parse_records(dataset);
+
+				if (use_stats)
+					bench_stats(dataset, records);
+
+				if (use_write)
+					bench_write(dataset, records);
+			}
+		}
+	}
+
+	bench_gen();
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		ios::sync_with_stdio(false);
+		parse_args(argc, argv);
+
+		open_file(NULL_DEVICE, "wb", &null_fp);
+
+		printf("%-36s %10s %10s %10s %12s %12s\n", "benchmark", "median_ms", "min_ms", "stddev_ms", "MiB/s", "Mitems/s");
+		run_benches();
+
+		close_file(null_fp);
+	}
+	catch (const exception& e)
+	{
+		cout << e.what() << endl;
+		exit(errno);
+	}
+
+	return 0;
+}
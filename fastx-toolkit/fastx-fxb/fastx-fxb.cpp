@@ -0,0 +1,207 @@
+#include <cstdio>
+#include <format>
+#include <iostream>
+#include <memory>
+#include "args.hxx"
+#include "fastx.hpp"
+#include "fastx-reader.hpp"
+#include "fastx-writer.hpp"
+#include "fxb.hpp"
+#include "perf-counters.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+/* Argument parser constants */
+static const char* PROLOGUE = "Encode FASTQ into the packed .fxb format, or decode .fxb back into FASTQ";
+static const char* EPILOGUE = "";
+
+/* I/O variables */
+static unique_ptr<FastxWriter> writer;
+
+/* Argument variables */
+static string trace_path;
+static bool perf_counters = false;
+static bool decode = false;
+static size_t block_records = FXB_BLOCK_RECORDS;
+
+static size_t in_buf_size = 32768;
+static size_t out_buf_size = 32768;
+static size_t num_out_bufs = NUM_OUT_BUFS;
+
+/* libfastx variables */
+static FastxContext_t fastx_ctx;
+
+void valid_args()
+{
+	bool result = true;
+
+	result &= block_records > 0;
+	result &= in_buf_size > 0 && out_buf_size > 0;
+	result &= fastx_ctx.max_seq_len > 0;
+	result &= fastx_ctx.num_in_bufs >= 2;
+	result &= num_out_bufs >= 2;
+	result &= fastx_ctx.long_reads || in_buf_size >= fastx_ctx.max_seq_len;
+
+	if (!result)
+		throw invalid_argument("Invalid arguments");
+}
+
+void parse_args(int argc, char** argv)
+{
+	args::ArgumentParser parser(PROLOGUE, EPILOGUE);
+	args::HelpFlag help(parser, "help", "Display options", { 'h', "help" });
+
+	args::ValueFlag<string> in_arg(parser, "in", "input file name. default is STDIN", { 'i' }, fastx_ctx.in_name);
+	args::ValueFlag<string> out_arg(parser, "out", "output file name. default is STDOUT", { 'o' }, fastx_ctx.out_name);
+	args::Flag decode_arg(parser, "d", format("decode .fxb into FASTQ. default is {}", decode), { 'd' }, decode);
+	args::ValueFlag<size_t> br_arg(parser, "br", format("records per .fxb block. default is {}", block_records), { "br" }, block_records);
+
+	args::Group io_tuning_group(parser, "I/O Tuning");
+	args::ValueFlag<size_t> ibufs_arg(io_tuning_group, "ibufs", format("input buffer size. default is {}", in_buf_size), { "ibufs" }, in_buf_size);
+	args::ValueFlag<size_t> ibufn_arg(io_tuning_group, "ibufn", format("number of input buffers read ahead in the background. default is {}", fastx_ctx.num_in_bufs), { "ibufn" }, fastx_ctx.num_in_bufs);
+	args::ValueFlag<size_t> obufs_arg(io_tuning_group, "obufs", format("output buffer size. default is {}", out_buf_size), { "obufs" }, out_buf_size);
+	args::ValueFlag<size_t> obufn_arg(io_tuning_group, "obufn", format("number of output buffers written in the background. default is {}", num_out_bufs), { "obufn" }, num_out_bufs);
+	args::ValueFlag<size_t> mxsl_arg(io_tuning_group, "mxsl", format("maximum sequence length. default is {}", fastx_ctx.max_seq_len), { "mxsl" }, fastx_ctx.max_seq_len);
+	args::Flag long_arg(io_tuning_group, "long", "long-read mode: no max sequence length, records may span input buffers. default is false", { "long" }, fastx_ctx.long_reads);
+	args::MapFlag<string, IoMode> io_arg(io_tuning_group, "io", "input mode: mmap or read. mmap falls back to read for pipes. default is mmap", { "io" }, {
+	{ "mmap", IoMode::IO_MODE_MMAP },
+	{ "read", IoMode::IO_MODE_READ } }, fastx_ctx.io_mode);
+
+	args::Group diag_group(parser, "Diagnostics");
+	args::ValueFlag<string> trace_arg(diag_group, "trace", "write a Chrome trace JSON timeline to the file", { "trace" }, trace_path);
+	args::Flag perf_arg(diag_group, "perf-counters", "print hardware counters per processing stage to STDERR. default is false", { "perf-counters" }, perf_counters);
+
+	try
+	{
+		parser.ParseCLI(argc, argv);
+		trace_path = args::get(trace_arg);
+		perf_counters = perf_arg;
+
+		args::get(in_arg).copy(fastx_ctx.in_name, MAX_PATH, 0);
+		args::get(out_arg).copy(fastx_ctx.out_name, MAX_PATH, 0);
+		decode = args::get(decode_arg);
+		block_records = args::get(br_arg);
+
+		in_buf_size = args::get(ibufs_arg);
+		fastx_ctx.num_in_bufs = args::get(ibufn_arg);
+		out_buf_size = args::get(obufs_arg);
+		num_out_bufs = args::get(obufn_arg);
+		fastx_ctx.max_seq_len = args::get(mxsl_arg);
+		fastx_ctx.long_reads = long_arg;
+		fastx_ctx.io_mode = args::get(io_arg);
+
+		valid_args();
+	}
+	catch (const exception& e)
+	{
+		cout << parser << endl;
+		cerr << e.what() << endl;
+		exit(errno);
+	}
+}
+
+void open_files()
+{
+	open_file(fastx_ctx.in_name, "rb", &fastx_ctx.in_stream);
+	open_input(&fastx_ctx);
+
+	open_file(fastx_ctx.out_name, "wb", &fastx_ctx.out_stream);
+	writer = make_unique<FastxWriter>(fastx_ctx.out_stream, out_buf_size, num_out_bufs);
+}
+
+void close_files()
+{
+	close_input(&fastx_ctx);
+
+	writer->flush();
+	writer.reset();
+	close_file(fastx_ctx.out_stream);
+}
+
+void encode_records()
+{
+	if (fastx_ctx.format != FileFormat::FILE_FORMAT_FASTQ || fastx_ctx.packed)
+		throw runtime_error("Invalid file format");
+
+	FastxReader reader(&fastx_ctx, in_buf_size);
+	span<FastxRecordView_t> batch = reader.next_batch();
+
+	// The line break is known once the first record is read
+	FxbEncoder encoder(writer.get(), fastx_ctx.line_break, block_records);
+
+	for (; !batch.empty(); batch = reader.next_batch())
+	{
+		FASTX_TRACE_SCOPE("encode");
+		FASTX_PERF_SCOPE(PERF_STAGE_AGGREGATE);
+
+		for (const FastxRecordView_t& record : batch)
+			encoder.encode(record);
+	}
+
+	encoder.finish();
+}
+
+void decode_records()
+{
+	if (!fastx_ctx.packed)
+		throw runtime_error("Invalid file format");
+
+	bool use_crlf = fastx_ctx.line_break == LineBreak::LINE_BREAK_CRLF;
+	FastxReader reader(&fastx_ctx, in_buf_size);
+
+	for (span<FastxRecordView_t> batch = reader.next_batch(); !batch.empty(); batch = reader.next_batch())
+	{
+		FASTX_TRACE_SCOPE("decode");
+		FASTX_PERF_SCOPE(PERF_STAGE_OUTPUT);
+
+		for (const FastxRecordView_t& record : batch)
+		{
+			writer->write(record.seq_id, record.seq_id_len);
+			writer->write_line_break(use_crlf);
+			writer->write(record.seq, record.seq_len);
+			writer->write_line_break(use_crlf);
+			writer->write(record.desc, record.desc_len);
+			writer->write_line_break(use_crlf);
+			writer->write(record.qual, record.qual_len);
+			writer->write_line_break(use_crlf);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		ios::sync_with_stdio(false);
+		parse_args(argc, argv);
+
+		if (!trace_path.empty())
+			trace_start();
+
+		if (perf_counters)
+			perf_start();
+
+		open_files();
+
+		if (decode)
+			decode_records();
+		else
+			encode_records();
+
+		close_files();
+
+		if (!trace_path.empty())
+			trace_write(trace_path);
+
+		if (perf_counters)
+			perf_report(stderr);
+	}
+	catch (const exception& e)
+	{
+		cout << e.what() << endl;
+		exit(errno);
+	}
+
+	return 0;
+}
@@ -1,56 +1,47 @@
+#include <atomic>
 #include <cinttypes>
 #include <cstdint>
 #include <cstring>
+#include <exception>
 #include <chrono>
 #include <format>
 #include <functional>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 #include <omp.h>
 #include "args.hxx"
+#include "column-stats.hpp"
 #include "fastx.hpp"
+#include "fastx-reader.hpp"
+#include "fxb.hpp"
+#include "fxi.hpp"
+#include "range-splitter.hpp"
+#include "perf-counters.hpp"
+#include "record-pipeline.hpp"
+#include "stats-report.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
-enum class Nucleotide : uint8_t
+enum class AggregationMode : uint8_t
 {
-	ALL, A, C, G, T, N,
-	_NUCLEOTIDE_COUNT_,
-	UNDEFINED
+	AGGREGATION_MODE_AUTO,
+	AGGREGATION_MODE_RECORDS, // Whole records into per-thread statistics
+	AGGREGATION_MODE_COLUMNS, // Columns of a batch spread over the threads
 };
 
-enum class OutputVersion : uint8_t
-{
-	V1, V2, UNDEFINED,
-};
-
-static constexpr uint8_t ALL = static_cast<uint8_t>(Nucleotide::ALL);
-static const vector<char> NUC_CHARS = { '\0', 'A', 'C', 'G', 'T', 'N' };
-static const vector<string> COMMON_HEADERS = { "count", "min", "max", "sum", "mean", "Q1", "med", "Q3", "IQR", "lW", "rW" };
-
-struct NucleotideStatistics
-{
-	int min = 100;
-	int max = -100;
-	uint64_t sum = 0;
-	uint64_t count = 0;
-	uint64_t base_counts[MAX_QUALITY - MIN_QUALITY] = { 0 };
-};
-
-struct ColumnStatistics
-{
-	NucleotideStatistics nuc_stats[static_cast<uint8_t>(Nucleotide::_NUCLEOTIDE_COUNT_)];
-};
+// Per-thread statistics of the records mode may hold this much before auto falls back to columns
+constexpr size_t PRIVATE_STATS_LIMIT = 256 << 20;
 
 /* Argument parser constants */
 static const char* PROLOGUE = "";
 static const char* EPILOGUE = "";
 
-/* I/O variables */
-static char* in_buf;
-
 /* Argument variables */
+static string trace_path;
+static bool perf_counters = false;
 static OutputVersion out_ver = OutputVersion::V1;
 
 static char base_qual_offset = BASE_QUALITY_OFFSET;
@@ -58,21 +49,25 @@ static char min_qual = MIN_QUALITY;
 static char max_qual = MAX_QUALITY;
 
 static size_t in_buf_size = 32768;
+
+static bool build_index = false;
+static size_t index_interval = FXI_INTERVAL;
 static size_t record_pool_size = 500;
+static size_t num_record_pools = 0; // 0 picks twice the threads
+static size_t queue_depth = 0; // 0 picks the number of threads
+static size_t ranges_per_thread = 4;
 static size_t num_threads = static_cast<size_t>(omp_get_max_threads());
 static bool dynamic_threads = static_cast<bool>(omp_get_dynamic());
+static AggregationMode agg_mode = AggregationMode::AGGREGATION_MODE_AUTO;
 
 /* Statistics variables */
-static ColumnStatistics* col_stats;
+static ColumnStatsStore col_stats; // Grows to the longest read
+static vector<ColumnStatsStore> thread_stats; // Private statistics of each thread, reduced into col_stats
+static size_t num_cols = 0; // Longest read so far
 static int nuc_idxs[numeric_limits<uint8_t>::max() + 1] = { 0 };
 
 /* libfastx variables */
 static FastxContext_t fastx_ctx;
-static FastxRecord_t* fastx_records;
-
-/* Internal variables */
-static size_t max_col = 0;
-static size_t curr_record_idx = 0;
 
 void valid_args()
 {
@@ -80,8 +75,12 @@ void valid_args()
 
 	result &= min_qual < max_qual;
 	result &= fastx_ctx.max_seq_len > 0;
-	result &= in_buf_size > 0 && in_buf_size >= fastx_ctx.max_seq_len;
+	result &= fastx_ctx.num_in_bufs >= 2;
+	result &= !build_index || (index_interval > 0 && strlen(fastx_ctx.in_name) > 0);
+	result &= in_buf_size > 0 && (fastx_ctx.long_reads || in_buf_size >= fastx_ctx.max_seq_len);
 	result &= record_pool_size > 0;
+	result &= num_record_pools >= 2 && queue_depth > 0;
+	result &= ranges_per_thread > 0;
 	result &= num_threads > 0;
 
 	if (!result)
@@ -105,16 +104,38 @@ void parse_args(int argc, char** argv)
 	args::ValueFlag<char> mnq_arg(qual_group, "mnq", format("min quality. default is {}", static_cast<int>(min_qual)), { "mnq" }, min_qual);
 	args::ValueFlag<char> mxq_arg(qual_group, "mxq", format("max quality. default is {}", static_cast<int>(max_qual)), { "mxq" }, max_qual);
 
+	args::Group index_group(parser, "Index");
+	args::Flag fxi_arg(index_group, "fxi", "write a record offset index next to the input file (<in>.fxi) while reading", { "fxi" }, build_index);
+	args::ValueFlag<size_t> fxik_arg(index_group, "fxik", format("records between index entries. default is {}", index_interval), { "fxik" }, index_interval);
+
 	args::Group io_tuning_group(parser, "I/O Tuning");
 	args::ValueFlag<size_t> ibufs_arg(io_tuning_group, "ibufs", format("input buffer size. default is {}", in_buf_size), { "ibufs" }, in_buf_size);
+	args::ValueFlag<size_t> ibufn_arg(io_tuning_group, "ibufn", format("number of input buffers read ahead in the background. default is {}", fastx_ctx.num_in_bufs), { "ibufn" }, fastx_ctx.num_in_bufs);
 	args::ValueFlag<size_t> mxsl_arg(io_tuning_group, "mxsl", format("max sequence length. default is {}", fastx_ctx.max_seq_len), { "mxsl" }, fastx_ctx.max_seq_len);
+	args::Flag long_arg(io_tuning_group, "long", "long-read mode: no max sequence length, records may span input buffers. default is false", { "long" }, fastx_ctx.long_reads);
+	args::MapFlag<string, IoMode> io_arg(io_tuning_group, "io", "input mode: mmap or read. mmap falls back to read for pipes. default is mmap", { "io" }, {
+	{ "mmap", IoMode::IO_MODE_MMAP },
+	{ "read", IoMode::IO_MODE_READ } }, fastx_ctx.io_mode);
 	args::ValueFlag<size_t> rps_arg(io_tuning_group, "rps", format("record pool size. default is {}", record_pool_size), { "rps" }, record_pool_size);
+	args::ValueFlag<size_t> rpn_arg(io_tuning_group, "rpn", "number of record pools in the parse/aggregate pipeline. default is twice the threads", { "rpn" });
+	args::ValueFlag<size_t> rpq_arg(io_tuning_group, "rpq", "max filled record pools queued for the aggregating threads. default is the number of threads", { "rpq" });
+	args::ValueFlag<size_t> rpt_arg(io_tuning_group, "rpt", format("byte ranges per thread when parsing a mapped file. default is {}", ranges_per_thread), { "rpt" }, ranges_per_thread);
 	args::ValueFlag<size_t> ths_arg(io_tuning_group, "ths", format("number of threads. default is {}", num_threads), { "ths" }, num_threads);
 	args::Flag omp_dyn_arg(io_tuning_group, "dyn", format("dynamic threads. default is {}", dynamic_threads), { "dyn" }, dynamic_threads);
+	args::MapFlag<string, AggregationMode> agg_arg(io_tuning_group, "agg", format("aggregation: auto, records or columns. auto aggregates whole records per thread unless that needs more than {} MiB. default is auto", PRIVATE_STATS_LIMIT >> 20), { "agg" }, {
+	{ "auto", AggregationMode::AGGREGATION_MODE_AUTO },
+	{ "records", AggregationMode::AGGREGATION_MODE_RECORDS },
+	{ "columns", AggregationMode::AGGREGATION_MODE_COLUMNS } }, agg_mode);
+
+	args::Group diag_group(parser, "Diagnostics");
+	args::ValueFlag<string> trace_arg(diag_group, "trace", "write a Chrome trace JSON timeline to the file", { "trace" }, trace_path);
+	args::Flag perf_arg(diag_group, "perf-counters", "print hardware counters per processing stage to STDERR. default is false", { "perf-counters" }, perf_counters);
 
 	try
 	{
 		parser.ParseCLI(argc, argv);
+		trace_path = args::get(trace_arg);
+		perf_counters = perf_arg;
 
 		out_ver = args::get(ov_arg);
 
@@ -125,11 +146,22 @@ void parse_args(int argc, char** argv)
 		min_qual = args::get(mnq_arg);
 		max_qual = args::get(mxq_arg);
 
+		build_index = fxi_arg;
+		index_interval = args::get(fxik_arg);
+
 		in_buf_size = args::get(ibufs_arg);
+		fastx_ctx.num_in_bufs = args::get(ibufn_arg);
 		fastx_ctx.max_seq_len = args::get(mxsl_arg);
+		fastx_ctx.long_reads = long_arg;
+		fastx_ctx.io_mode = args::get(io_arg);
 		record_pool_size = args::get(rps_arg);
+		ranges_per_thread = args::get(rpt_arg);
 		num_threads = args::get(ths_arg);
+		num_record_pools = rpn_arg ? args::get(rpn_arg) : max(num_threads * 2, static_cast<size_t>(2));
+		queue_depth = rpq_arg ? args::get(rpq_arg) : num_threads;
+		fastx_ctx.num_inflate_threads = num_threads;
 		dynamic_threads = omp_dyn_arg;
+		agg_mode = args::get(agg_arg);
 
 		valid_args();
 	}
@@ -143,274 +175,412 @@ void parse_args(int argc, char** argv)
 
 void init_vals()
 {
-	for (int i = 0; i < NUC_CHARS.size(); ++i)
-	{
-		nuc_idxs[NUC_CHARS[i]] = i;
-		nuc_idxs[tolower(NUC_CHARS[i])] = i;
-	}
+	init_nuc_idxs(nuc_idxs);
 }
 
 void set_omp_opts()
 {
 	omp_set_num_threads(static_cast<int>(num_threads));
 	omp_set_dynamic(static_cast<int>(dynamic_threads));
-}
-
-void alloc_bufs()
-{
-	in_buf = new char[in_buf_size];
-
-	fastx_records = new FastxRecord_t[record_pool_size];
-	memset(fastx_records, 0, sizeof(FastxRecord_t) * record_pool_size);
-
-	for (size_t i = 0; i < record_pool_size; ++i)
-	{
-		fastx_records[i].seq_id = new char[fastx_ctx.max_seq_len];
-		fastx_records[i].seq = new char[fastx_ctx.max_seq_len];
-		fastx_records[i].qual = new char[fastx_ctx.max_seq_len];
-	}
 
-	col_stats = new ColumnStatistics[fastx_ctx.max_seq_len];
+	thread_stats.resize(static_cast<size_t>(omp_get_max_threads()));
 }
 
 void free_bufs()
 {
-	if (in_buf) delete[] in_buf;
-
-	if (fastx_records)
-	{
-		for (size_t i = 0; i < record_pool_size; ++i)
-		{
-			delete[] fastx_records[i].seq_id;
-			delete[] fastx_records[i].seq;
-			delete[] fastx_records[i].qual;
-		}
-
-		delete[] fastx_records;
-	}
-
-	if (col_stats) delete[] col_stats;
+	col_stats.clear();
+	thread_stats.clear();
+	thread_stats.shrink_to_fit();
 }
 
 void open_files()
 {
 	open_file(fastx_ctx.in_name, "rb", &fastx_ctx.in_stream);
-	fastx_ctx.format = get_file_format(fastx_ctx.in_stream);
+	open_input(&fastx_ctx);
+
+	if (build_index)
+		fastx_ctx.index.reset(new FxiIndex(index_interval));
 
 	open_file(fastx_ctx.out_name, "wb", &fastx_ctx.out_stream);
 }
 
 void close_files()
 {
-	close_file(fastx_ctx.in_stream);
+	close_input(&fastx_ctx);
 	close_file(fastx_ctx.out_stream);
 }
 
-void update_nuc_statistics(size_t col_idx, uint8_t nuc_idx, int qual, size_t read_count)
-{
-	col_stats[col_idx].nuc_stats[nuc_idx].count += read_count;
-
-	if (fastx_ctx.format == FileFormat::FILE_FORMAT_FASTQ)
-	{
-		col_stats[col_idx].nuc_stats[nuc_idx].min = min(col_stats[col_idx].nuc_stats[nuc_idx].min, qual);
-		col_stats[col_idx].nuc_stats[nuc_idx].max = max(col_stats[col_idx].nuc_stats[nuc_idx].max, qual);
-		col_stats[col_idx].nuc_stats[nuc_idx].sum += qual;
-		col_stats[col_idx].nuc_stats[nuc_idx].base_counts[qual - MIN_QUALITY] += read_count;
-	}
-}
-
-void flush_records(size_t num_flush_records)
+// Merges the thread statistics pairwise in log2(threads) parallel rounds, then into col_stats
+void reduce_thread_stats()
 {
-#pragma omp parallel for
-	for (size_t i = 0; i < max_col; ++i)
+	for (size_t stride = 1; stride < thread_stats.size(); stride *= 2)
 	{
-		for (size_t j = 0; j < num_flush_records; ++j)
+#pragma omp parallel for schedule(dynamic, 1)
+		for (size_t i = 0; i < thread_stats.size(); i += 2 * stride)
 		{
-			 if (fastx_records[j].seq_len <= i)
-			 	continue;
-			 
-			 char nuc = fastx_records[j].seq[i];
-			 int qual = fastx_records[j].qual[i] - base_qual_offset;
-
-			 update_nuc_statistics(i, ALL, qual, fastx_records[j].read_count);
-			 update_nuc_statistics(i, nuc_idxs[nuc], qual, fastx_records[j].read_count);
+			if (i + stride >= thread_stats.size() || thread_stats[i + stride].empty())
+				continue;
+
+			FASTX_TRACE_SCOPE("merge");
+			FASTX_PERF_SCOPE(PERF_STAGE_AGGREGATE);
+			thread_stats[i].merge(thread_stats[i + stride]);
+			thread_stats[i + stride].clear();
 		}
 	}
-}
 
-void process_record(FastxRecord_t* record, size_t record_idx)
-{
-	max_col = max(record->seq_len, max_col);
+	if (thread_stats.empty())
+		return;
 
-	if (curr_record_idx == record_pool_size - 1)
-	{
-		flush_records(record_pool_size);
-		curr_record_idx = 0;
-		max_col = 0;
-	}
+	if (col_stats.empty())
+		swap(col_stats, thread_stats[0]);
 	else
-		++curr_record_idx;
+		col_stats.merge(thread_stats[0]);
+
+	thread_stats[0].clear();
 }
 
-void read_records()
+bool use_record_aggregation(size_t cols = num_cols)
 {
-	DispatchResult_t result;
-	function<void(FastxRecord_t*, size_t)> callback = process_record;
+	if (agg_mode != AggregationMode::AGGREGATION_MODE_AUTO)
+		return agg_mode == AggregationMode::AGGREGATION_MODE_RECORDS;
 
-	if (fastx_ctx.format == FileFormat::FILE_FORMAT_UNKNOWN)
-		throw runtime_error("Unknown file format");
+	return thread_stats.size() * cols * ColumnStatsStore::COLUMN_BYTES <= PRIVATE_STATS_LIMIT;
+}
+
+// Each thread adds whole records to its own statistics, so there is no striding across records or sharing
+void aggregate_records(span<FastxRecordView_t> records)
+{
+	exception_ptr error;
 
-	do
+#pragma omp parallel
 	{
-		result = dispatch_records(
-			in_buf, in_buf_size, result.num_rem_bytes,
-			&fastx_ctx,
-			fastx_records,
-			&curr_record_idx,
-			callback);
+		FASTX_TRACE_SCOPE("aggregate");
+		FASTX_PERF_SCOPE(PERF_STAGE_AGGREGATE);
+		ColumnStatsStore& stats = thread_stats[omp_get_thread_num()];
 
-	} while (result.num_proc_bytes);
+#pragma omp for schedule(dynamic, 16) nowait
+		for (size_t j = 0; j < records.size(); ++j)
+		{
+			// An exception must not leave the parallel region
+			try
+			{
+				stats.add_record(records[j], base_qual_offset);
+			}
+			catch (...)
+			{
+#pragma omp critical
+				if (!error)
+					error = current_exception();
+			}
+		}
+	}
 
-	flush_records(curr_record_idx);
+	if (error)
+		rethrow_exception(error);
 }
 
-int64_t get_nth_value(uint64_t col_idx, uint8_t nuc_idx, uint64_t q)
+void aggregate_columns(span<FastxRecordView_t> records)
 {
-	int64_t pos = 0;
+	size_t max_col = num_cols;
+	uint64_t read_count = 0;
 
-	if (col_idx > fastx_ctx.max_seq_len)
-		throw out_of_range(format("Invalid range: col_idx={}, nuc_idx={}", col_idx, nuc_idx));
+	for (const FastxRecordView_t& record : records)
+		read_count += record.read_count;
 
-	if (q == 0)
-		return col_stats[col_idx].nuc_stats[nuc_idx].min;
+	// The threads share col_stats, so it is grown and promoted before they start
+	col_stats.resize(max_col);
+	col_stats.reserve_reads(read_count);
 
-	if (q >= col_stats[col_idx].nuc_stats[nuc_idx].count)
-		throw out_of_range(format("Invalid range: quantile={}", q));
+	exception_ptr error;
 
-	while (q > 0)
+#pragma omp parallel
 	{
-		if (col_stats[col_idx].nuc_stats[nuc_idx].base_counts[pos] > q)
-			break;
+		// One span per thread and batch shows how evenly the columns are spread
+		FASTX_TRACE_SCOPE("aggregate");
+		FASTX_PERF_SCOPE(PERF_STAGE_AGGREGATE);
 
-		q -= col_stats[col_idx].nuc_stats[nuc_idx].base_counts[pos];
-		pos++;
-
-		while (col_stats[col_idx].nuc_stats[nuc_idx].base_counts[pos] == 0)
-			pos++;
+#pragma omp for
+		for (size_t i = 0; i < max_col; ++i)
+		{
+			for (size_t j = 0; j < records.size(); ++j)
+			{
+				 if (records[j].seq_len <= i)
+				 	continue;
+				 
+				 char nuc = records[j].seq[i];
+				 int qual = records[j].qual ? records[j].qual[i] - base_qual_offset : 0;
+
+				 // An exception must not leave the parallel region
+				 if (records[j].qual && !is_valid_quality(qual))
+				 {
+#pragma omp critical
+					 if (!error)
+						 error = make_exception_ptr(runtime_error(format("Invalid quality: qual={}, col_idx={}", qual, i)));
+
+					 break;
+				 }
+
+				 col_stats.add_base(i, nuc_idxs[static_cast<uint8_t>(nuc)], qual, records[j].read_count, records[j].qual != nullptr);
+			}
+		}
 	}
 
-	return pos + min_qual;
+	if (error)
+		rethrow_exception(error);
 }
 
-void print_headers(Nucleotide nuc = Nucleotide::UNDEFINED)
+void flush_records(span<FastxRecordView_t> records)
 {
-	for (const auto& header : COMMON_HEADERS)
+	for (const FastxRecordView_t& record : records)
+		num_cols = max(record.seq_len, num_cols);
+
+	if (use_record_aggregation())
 	{
-		if (out_ver == OutputVersion::V1)
-			fprintf(fastx_ctx.out_stream, "\t%s", header.c_str());
-		else
-		{
-			if (nuc == Nucleotide::ALL)
-				fprintf(fastx_ctx.out_stream, "\tALL_%s", header.c_str());
-			else
-				fprintf(fastx_ctx.out_stream, "\t%c_%s", NUC_CHARS[static_cast<int>(nuc)], header.c_str());
-		}
+		aggregate_records(records);
+		return;
 	}
+
+	// Reads grew past the limit: checkpoint the private statistics and continue by columns
+	reduce_thread_stats();
+	aggregate_columns(records);
 }
 
-void print_nuc_stats(uint64_t col_idx, uint8_t nuc_idx)
+// Returns false without statistics once a read outgrows the private statistics, so the caller reads the
+// input again and aggregates it by columns
+bool read_ranges()
 {
-	int64_t q1, q3, iqr;
-	int64_t left_wisker, right_wisker;
-	uint64_t i = col_idx;
+	size_t num_ranges = num_threads * ranges_per_thread;
+	vector<ByteRange_t> ranges;
+	FxiIndex index;
+
+	// An up-to-date offset index gives exact record boundaries without resynchronizing
+	if (fastx_ctx.packed)
+		ranges = split_fxb_blocks(fastx_ctx.map_base, fastx_ctx.map_size, num_ranges);
+	else if (load_index(&index, fastx_ctx.in_name))
+		ranges = index.split(num_ranges);
+
+	// A stale index would cut records apart
+	if (!fastx_ctx.packed && (ranges.empty() || !starts_records(fastx_ctx.map_base, fastx_ctx.map_size, ranges, fastx_ctx.format)))
+		ranges = split_ranges(fastx_ctx.map_base, fastx_ctx.map_size, fastx_ctx.format, num_ranges);
+
+	size_t total_read_lines = 0;
+	size_t total_read_records = 0;
+	size_t total_seq_count = 0;
+	atomic<bool> too_long = false;
+	exception_ptr error;
+
+#pragma omp parallel
+	{
+		// Each thread parses whole ranges into private statistics, reduced once at the end
+		FastxContext_t range_ctx = copy_context_settings(fastx_ctx);
+		ColumnStatsStore stats;
 
-	q1 = get_nth_value(i, nuc_idx, col_stats[i].nuc_stats[nuc_idx].count / 4);
-	q3 = get_nth_value(i, nuc_idx, col_stats[i].nuc_stats[nuc_idx].count * 3 / 4);
-	iqr = q3 - q1;
+#pragma omp for schedule(dynamic, 1)
+		for (size_t i = 0; i < ranges.size(); ++i)
+		{
+			if (too_long)
+				continue;
+
+			// An exception must not leave the parallel region
+			try
+			{
+				FASTX_TRACE_SCOPE("range");
+				FastxReader reader(&range_ctx, fastx_ctx.map_base + ranges[i].begin, ranges[i].end - ranges[i].begin, record_pool_size);
+
+				for (span<FastxRecordView_t> batch = reader.next_batch(); !batch.empty() && !too_long; batch = reader.next_batch())
+				{
+					size_t max_col = stats.size();
+
+					for (const FastxRecordView_t& record : batch)
+						max_col = max(record.seq_len, max_col);
+
+					// Every thread may grow its statistics this far, so the limit holds for all of them
+					if (!use_record_aggregation(max_col))
+					{
+						too_long = true;
+						break;
+					}
+
+					FASTX_TRACE_SCOPE("aggregate");
+					FASTX_PERF_SCOPE(PERF_STAGE_AGGREGATE);
+
+					for (const FastxRecordView_t& record : batch)
+						stats.add_record(record, base_qual_offset);
+				}
+			}
+			catch (...)
+			{
+#pragma omp critical
+				if (!error)
+					error = current_exception();
+			}
+		}
+
+		swap(thread_stats[omp_get_thread_num()], stats);
 
-	left_wisker = q1 - iqr * 3 / 2;
-	right_wisker = q3 + iqr * 3 / 2;
+#pragma omp critical
+		{
+			total_read_lines += range_ctx.total_read_lines;
+			total_read_records += range_ctx.total_read_records;
+			total_seq_count += range_ctx.total_seq_count;
+		}
+	}
 
-	if (left_wisker < col_stats[i].nuc_stats[nuc_idx].min)
-		left_wisker = col_stats[i].nuc_stats[nuc_idx].min;
+	if (error)
+		rethrow_exception(error);
 
-	if (right_wisker > col_stats[i].nuc_stats[nuc_idx].max)
-		right_wisker = col_stats[i].nuc_stats[nuc_idx].max;
+	if (too_long)
+	{
+		for (ColumnStatsStore& stats : thread_stats)
+			stats.clear();
 
-	if (out_ver == OutputVersion::V1)
-		fprintf(fastx_ctx.out_stream, "%" PRIu64 "\t", i + 1);
+		return false;
+	}
 
-	fprintf(fastx_ctx.out_stream, "%" PRIu64 "\t%d\t%d\t%" PRIu64 "\t",
-		col_stats[i].nuc_stats[nuc_idx].count,
-		col_stats[i].nuc_stats[nuc_idx].min,
-		col_stats[i].nuc_stats[nuc_idx].max,
-		col_stats[i].nuc_stats[nuc_idx].sum);
+	fastx_ctx.total_read_lines += total_read_lines;
+	fastx_ctx.total_read_records += total_read_records;
+	fastx_ctx.total_seq_count += total_seq_count;
 
-	fprintf(fastx_ctx.out_stream, "%3.2f\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t",
-		(static_cast<double>(col_stats[i].nuc_stats[nuc_idx].sum)) / (static_cast<double>(col_stats[i].nuc_stats[nuc_idx].count)),
-		q1,
-		get_nth_value(i, nuc_idx, col_stats[i].nuc_stats[nuc_idx].count / 2),
-		q3);
+	reduce_thread_stats();
 
-	fprintf(fastx_ctx.out_stream, "%" PRId64 "\t%" PRId64 "\t%" PRId64, iqr, left_wisker, right_wisker);
+	return true;
 }
 
-void print_v1_stats()
+// A parser thread copies batches into pools while the OpenMP threads aggregate earlier pools
+void read_pipelined()
 {
-	fprintf(fastx_ctx.out_stream, "column");
-	print_headers();
-	fprintf(fastx_ctx.out_stream, "\tA_Count\tC_Count\tG_Count\tT_Count\tN_Count\t");
-	fprintf(fastx_ctx.out_stream, "Max_count\n");
+	FastxReader reader(&fastx_ctx, in_buf_size, record_pool_size);
+	RecordPipeline pipeline(num_record_pools, queue_depth);
+	span<FastxRecordView_t> rest; // The batch that outgrew the private statistics, still valid in reader
 
-	for (size_t i = 0; i < fastx_ctx.max_seq_len; ++i)
+	thread parser([&]()
+		{
+			FASTX_TRACE_THREAD("parser");
+
+			try
+			{
+				for (span<FastxRecordView_t> batch = reader.next_batch(); !batch.empty(); batch = reader.next_batch())
+				{
+					size_t max_col = num_cols;
+
+					for (const FastxRecordView_t& record : batch)
+						max_col = max(record.seq_len, max_col);
+
+					if (!use_record_aggregation(max_col))
+					{
+						rest = batch;
+						break;
+					}
+
+					RecordPool_t* pool = pipeline.acquire();
+
+					if (!pool)
+						return;
+
+					{
+						FASTX_TRACE_SCOPE("copy");
+						FASTX_PERF_SCOPE(PERF_STAGE_PARSE);
+						fill_pool(pool, batch);
+					}
+
+					num_cols = max_col;
+					pipeline.push(pool);
+				}
+
+				pipeline.close();
+			}
+			catch (...)
+			{
+				pipeline.fail(current_exception());
+			}
+		});
+
+#pragma omp parallel
 	{
-		if (col_stats[i].nuc_stats[ALL].count == 0)
-			break;
+		ColumnStatsStore& stats = thread_stats[omp_get_thread_num()];
 
-		print_nuc_stats(i, ALL);
+		try
+		{
+			for (RecordPool_t* pool = pipeline.pop(); pool; pool = pipeline.pop())
+			{
+				{
+					FASTX_TRACE_SCOPE("aggregate");
+					FASTX_PERF_SCOPE(PERF_STAGE_AGGREGATE);
+
+					for (const FastxRecordView_t& record : pool->records)
+						stats.add_record(record, base_qual_offset);
+				}
+
+				pipeline.release(pool);
+			}
+		}
+		catch (...)
+		{
+			pipeline.fail(current_exception());
+		}
+	}
 
-		fprintf(fastx_ctx.out_stream, "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t",
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::A)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::C)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::G)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::T)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::N)].count);
+	parser.join();
+	pipeline.rethrow_error();
 
-		fprintf(fastx_ctx.out_stream, "%" PRIu64 "\n", col_stats[0].nuc_stats[ALL].count);
-	}
+	// Reads grew past the limit: the rest of the input is aggregated by columns
+	for (span<FastxRecordView_t> batch = rest; !batch.empty(); batch = reader.next_batch())
+		flush_records(batch);
+
+	reduce_thread_stats();
 }
 
-void print_v2_stats()
+void read_records()
 {
-	fprintf(fastx_ctx.out_stream, "cycle\tmax_count");
-
-	for (int i = 0; i < NUC_CHARS.size(); ++i)
-		print_headers(static_cast<Nucleotide>(i));
-
-	fprintf(fastx_ctx.out_stream, "\n");
+	if (fastx_ctx.format == FileFormat::FILE_FORMAT_UNKNOWN)
+		throw runtime_error("Unknown file format");
 
-	uint64_t max_count = col_stats[0].nuc_stats[static_cast<int>(Nucleotide::ALL)].count;
+	// A mapped file can be cut into independent ranges of private statistics. Streams, index builds, column
+	// aggregation and reads too long for private statistics are parsed in order.
+	if (fastx_ctx.map_base && num_threads > 1 && !fastx_ctx.index && agg_mode != AggregationMode::AGGREGATION_MODE_COLUMNS && read_ranges())
+		return;
 
-	for (size_t i = 0; i < fastx_ctx.max_seq_len; ++i)
+	// Streams overlap parsing with aggregation unless the columns of each batch are spread over the threads
+	if (num_threads > 1 && agg_mode != AggregationMode::AGGREGATION_MODE_COLUMNS)
 	{
-		if (col_stats[i].nuc_stats[ALL].count == 0)
-			break;
+		read_pipelined();
+		return;
+	}
 
-		fprintf(fastx_ctx.out_stream, "%zd\t%zd\t", i + 1, max_count);
+	FastxReader reader(&fastx_ctx, in_buf_size, record_pool_size);
 
-		for (int j = 0; j < NUC_CHARS.size(); ++j)
-			print_nuc_stats(i, static_cast<uint8_t>(j));
+	for (span<FastxRecordView_t> batch = reader.next_batch(); !batch.empty(); batch = reader.next_batch())
+		flush_records(batch);
 
-		fprintf(fastx_ctx.out_stream, "\n");
-	}
+	reduce_thread_stats();
 }
 
+// Blocks of rows are formatted by all threads and written in order
 void print_stats()
 {
-	if (out_ver == OutputVersion::V1)
-		print_v1_stats();
-	else
-		print_v2_stats();
+	FASTX_TRACE_SCOPE("report");
+	FASTX_PERF_SCOPE(PERF_STAGE_OUTPUT);
+	size_t num_rows = get_report_rows(col_stats);
+	size_t num_blocks = (num_rows + REPORT_BLOCK_ROWS - 1) / REPORT_BLOCK_ROWS;
+	string header;
+
+	format_report_header(&header, out_ver);
+	fwrite(header.data(), 1, header.size(), fastx_ctx.out_stream);
+
+#pragma omp parallel
+	{
+		string buf;
+
+#pragma omp for ordered schedule(static, 1)
+		for (size_t i = 0; i < num_blocks; ++i)
+		{
+			buf.clear();
+			format_report_rows(&buf, col_stats, i * REPORT_BLOCK_ROWS, min((i + 1) * REPORT_BLOCK_ROWS, num_rows), out_ver, min_qual);
+
+#pragma omp ordered
+			fwrite(buf.data(), 1, buf.size(), fastx_ctx.out_stream);
+		}
+	}
 }
 
 int main(int argc, char** argv)
@@ -419,17 +589,30 @@ int main(int argc, char** argv)
 	{
 		ios::sync_with_stdio(false);
 		parse_args(argc, argv);
+
+		if (!trace_path.empty())
+			trace_start();
+
+		if (perf_counters)
+			perf_start();
+
 		set_omp_opts();
 		init_vals();
 
-		alloc_bufs();
 		open_files();
 
 		read_records();
+		write_index(&fastx_ctx);
 		print_stats();
 
 		close_files();
 		free_bufs();
+
+		if (!trace_path.empty())
+			trace_write(trace_path);
+
+		if (perf_counters)
+			perf_report(stderr);
 	}
 	catch (const exception& e)
 	{
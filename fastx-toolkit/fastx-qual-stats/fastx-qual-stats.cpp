@@ -8,48 +8,23 @@
 #include <stdexcept>
 #include <vector>
 #include "args.hxx"
+#include "column-stats.hpp"
 #include "fastx.hpp"
+#include "fastx-reader.hpp"
+#include "fxi.hpp"
+#include "perf-counters.hpp"
+#include "stats-report.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
-enum class Nucleotide : uint8_t
-{
-	ALL, A, C, G, T, N,
-	_NUCLEOTIDE_COUNT_,
-	UNDEFINED
-};
-
-enum class OutputVersion : uint8_t
-{
-	V1, V2, UNDEFINED,
-};
-
-static constexpr uint8_t ALL = static_cast<uint8_t>(Nucleotide::ALL);
-static const vector<char> NUC_CHARS = { '\0', 'A', 'C', 'G', 'T', 'N' };
-static const vector<string> COMMON_HEADERS = { "count", "min", "max", "sum", "mean", "Q1", "med", "Q3", "IQR", "lW", "rW" };
-
-struct NucleotideStatistics
-{
-	int min = 100;
-	int max = -100;
-	uint64_t sum = 0;
-	uint64_t count = 0;
-	uint64_t base_counts[MAX_QUALITY - MIN_QUALITY] = { 0 };
-};
-
-struct ColumnStatistics
-{
-	NucleotideStatistics nuc_stats[static_cast<uint8_t>(Nucleotide::_NUCLEOTIDE_COUNT_)];
-};
-
 /* Argument parser constants */
 static const char* PROLOGUE = "";
 static const char* EPILOGUE = "";
 
-/* I/O variables */
-static char* in_buf;
-
 /* Argument variables */
+static string trace_path;
+static bool perf_counters = false;
 static OutputVersion out_ver = OutputVersion::V1;
 
 static char base_qual_offset = BASE_QUALITY_OFFSET;
@@ -58,13 +33,14 @@ static char max_qual = MAX_QUALITY;
 
 static size_t in_buf_size = 32768;
 
+static bool build_index = false;
+static size_t index_interval = FXI_INTERVAL;
+
 /* Statistics variables */
-static ColumnStatistics* col_stats;
-static int nuc_idxs[numeric_limits<uint8_t>::max() + 1] = { 0 };
+static ColumnStatsStore col_stats; // Grows to the longest read
 
 /* libfastx variables */
 static FastxContext_t fastx_ctx;
-static FastxRecord_t fastx_record;
 
 void valid_args()
 {
@@ -72,7 +48,9 @@ void valid_args()
 
 	result &= min_qual < max_qual;
 	result &= fastx_ctx.max_seq_len > 0;
-	result &= in_buf_size > 0 && in_buf_size >= fastx_ctx.max_seq_len;
+	result &= fastx_ctx.num_in_bufs >= 2;
+	result &= !build_index || (index_interval > 0 && strlen(fastx_ctx.in_name) > 0);
+	result &= in_buf_size > 0 && (fastx_ctx.long_reads || in_buf_size >= fastx_ctx.max_seq_len);
 
 	if (!result)
 		throw invalid_argument("Invalid arguments");
@@ -95,13 +73,28 @@ void parse_args(int argc, char** argv)
 	args::ValueFlag<char> mnq_arg(qual_group, "mnq", format("min quality. default is {}", static_cast<int>(min_qual)), { "mnq" }, min_qual);
 	args::ValueFlag<char> mxq_arg(qual_group, "mxq", format("max quality. default is {}", static_cast<int>(max_qual)), { "mxq" }, max_qual);
 
+	args::Group index_group(parser, "Index");
+	args::Flag fxi_arg(index_group, "fxi", "write a record offset index next to the input file (<in>.fxi) while reading", { "fxi" }, build_index);
+	args::ValueFlag<size_t> fxik_arg(index_group, "fxik", format("records between index entries. default is {}", index_interval), { "fxik" }, index_interval);
+
 	args::Group io_tuning_group(parser, "I/O Tuning");
 	args::ValueFlag<size_t> ibufs_arg(io_tuning_group, "ibufs", format("input buffer size. default is {}", in_buf_size), { "ibufs" }, in_buf_size);
+	args::ValueFlag<size_t> ibufn_arg(io_tuning_group, "ibufn", format("number of input buffers read ahead in the background. default is {}", fastx_ctx.num_in_bufs), { "ibufn" }, fastx_ctx.num_in_bufs);
 	args::ValueFlag<size_t> mxsl_arg(io_tuning_group, "mxsl", format("max sequence length. default is {}", fastx_ctx.max_seq_len), { "mxsl" }, fastx_ctx.max_seq_len);
+	args::Flag long_arg(io_tuning_group, "long", "long-read mode: no max sequence length, records may span input buffers. default is false", { "long" }, fastx_ctx.long_reads);
+	args::MapFlag<string, IoMode> io_arg(io_tuning_group, "io", "input mode: mmap or read. mmap falls back to read for pipes. default is mmap", { "io" }, {
+	{ "mmap", IoMode::IO_MODE_MMAP },
+	{ "read", IoMode::IO_MODE_READ } }, fastx_ctx.io_mode);
+
+	args::Group diag_group(parser, "Diagnostics");
+	args::ValueFlag<string> trace_arg(diag_group, "trace", "write a Chrome trace JSON timeline to the file", { "trace" }, trace_path);
+	args::Flag perf_arg(diag_group, "perf-counters", "print hardware counters per processing stage to STDERR. default is false", { "perf-counters" }, perf_counters);
 
 	try
 	{
 		parser.ParseCLI(argc, argv);
+		trace_path = args::get(trace_arg);
+		perf_counters = perf_arg;
 
 		out_ver = args::get(ov_arg);
 
@@ -112,8 +105,14 @@ void parse_args(int argc, char** argv)
 		min_qual = args::get(mnq_arg);
 		max_qual = args::get(mxq_arg);
 
+		build_index = fxi_arg;
+		index_interval = args::get(fxik_arg);
+
 		in_buf_size = args::get(ibufs_arg);
+		fastx_ctx.num_in_bufs = args::get(ibufn_arg);
 		fastx_ctx.max_seq_len = args::get(mxsl_arg);
+		fastx_ctx.long_reads = long_arg;
+		fastx_ctx.io_mode = args::get(io_arg);
 
 		valid_args();
 	}
@@ -125,235 +124,60 @@ void parse_args(int argc, char** argv)
 	}
 }
 
-void init_vals()
-{
-	for (int i = 0; i < NUC_CHARS.size(); ++i)
-	{
-		nuc_idxs[NUC_CHARS[i]] = i;
-		nuc_idxs[tolower(NUC_CHARS[i])] = i;
-	}
-}
-
-void alloc_bufs()
-{
-	in_buf = new char[in_buf_size];
-
-	memset(&fastx_record, 0, sizeof(FastxRecord_t));
-	fastx_record.seq_id = new char[fastx_ctx.max_seq_len];
-	fastx_record.seq = new char[fastx_ctx.max_seq_len];
-	fastx_record.qual = new char[fastx_ctx.max_seq_len];
-
-	col_stats = new ColumnStatistics[fastx_ctx.max_seq_len];
-}
-
 void free_bufs()
 {
-	if (in_buf) delete[] in_buf;
-
-	if (fastx_record.seq_id) delete[] fastx_record.seq_id;
-	if (fastx_record.seq) delete[] fastx_record.seq;
-	if (fastx_record.qual) delete[] fastx_record.qual;
-
-	if (col_stats) delete[] col_stats;
+	col_stats.clear();
 }
 
 void open_files()
 {
 	open_file(fastx_ctx.in_name, "rb", &fastx_ctx.in_stream);
-	fastx_ctx.format = get_file_format(fastx_ctx.in_stream);
+	open_input(&fastx_ctx);
+
+	if (build_index)
+		fastx_ctx.index.reset(new FxiIndex(index_interval));
 
 	open_file(fastx_ctx.out_name, "wb", &fastx_ctx.out_stream);
 }
 
 void close_files()
 {
-	close_file(fastx_ctx.in_stream);
+	close_input(&fastx_ctx);
 	close_file(fastx_ctx.out_stream);
 }
 
-void update_nuc_statistics(size_t col_idx, uint8_t nuc_idx, int qual, size_t read_count)
+void process_record(const FastxRecordView_t& record)
 {
-	col_stats[col_idx].nuc_stats[nuc_idx].count += read_count;
-
-	if (fastx_ctx.format == FileFormat::FILE_FORMAT_FASTQ)
-	{
-		col_stats[col_idx].nuc_stats[nuc_idx].min = min(col_stats[col_idx].nuc_stats[nuc_idx].min, qual);
-		col_stats[col_idx].nuc_stats[nuc_idx].max = max(col_stats[col_idx].nuc_stats[nuc_idx].max, qual);
-		col_stats[col_idx].nuc_stats[nuc_idx].sum += qual;
-		col_stats[col_idx].nuc_stats[nuc_idx].base_counts[qual - MIN_QUALITY] += read_count;
-	}
-}
-
-void process_record(FastxRecord_t* record, size_t record_idx)
-{
-	for (size_t i = 0; i < record->seq_len; ++i)
-	{
-		char nuc = fastx_record.seq[i];
-		int qual = fastx_record.qual[i] - base_qual_offset;
-
-		update_nuc_statistics(i, ALL, qual, record->read_count);
-		update_nuc_statistics(i, nuc_idxs[nuc], qual, record->read_count);
-	}
+	col_stats.add_record(record, base_qual_offset);
 }
 
 void read_records()
 {
-	size_t record_idx = 0; // FIXED: Receive only one record at each time.
-	DispatchResult_t result;
-	function<void(FastxRecord_t*, size_t)> callback = process_record;
-
 	if (fastx_ctx.format == FileFormat::FILE_FORMAT_UNKNOWN)
 		throw runtime_error("Unknown file format");
 
-	do
-	{
-		result = dispatch_records(
-			in_buf, in_buf_size, result.num_rem_bytes,
-			&fastx_ctx, 
-			&fastx_record,
-			&record_idx,
-			callback);
-
-	} while (result.num_proc_bytes);
-}
-
-int64_t get_nth_value(uint64_t col_idx, uint8_t nuc_idx, uint64_t q)
-{
-	int64_t pos = 0;
-
-	if (col_idx > fastx_ctx.max_seq_len)
-		throw out_of_range(format("Invalid range: col_idx={}, nuc_idx={}", col_idx, nuc_idx));
-
-	if (q == 0)
-		return col_stats[col_idx].nuc_stats[nuc_idx].min;
-
-	if (q >= col_stats[col_idx].nuc_stats[nuc_idx].count)
-		throw out_of_range(format("Invalid range: quantile={}", q));
+	FastxReader reader(&fastx_ctx, in_buf_size);
 
-	while (q > 0)
-	{
-		if (col_stats[col_idx].nuc_stats[nuc_idx].base_counts[pos] > q)
-			break;
-
-		q -= col_stats[col_idx].nuc_stats[nuc_idx].base_counts[pos];
-		pos++;
-
-		while (col_stats[col_idx].nuc_stats[nuc_idx].base_counts[pos] == 0)
-			pos++;
-	}
-
-	return pos + min_qual;
-}
-
-void print_headers(Nucleotide nuc = Nucleotide::UNDEFINED)
-{
-	for (const auto& header : COMMON_HEADERS)
-	{
-		if (out_ver == OutputVersion::V1)
-			fprintf(fastx_ctx.out_stream, "\t%s", header.c_str());
-		else
-		{
-			if (nuc == Nucleotide::ALL)
-				fprintf(fastx_ctx.out_stream, "\tALL_%s", header.c_str());
-			else
-				fprintf(fastx_ctx.out_stream, "\t%c_%s", NUC_CHARS[static_cast<int>(nuc)], header.c_str());
-		}
-	}
-}
-
-void print_nuc_stats(uint64_t col_idx, uint8_t nuc_idx)
-{
-	int64_t q1, q3, iqr;
-	int64_t left_wisker, right_wisker;
-	uint64_t i = col_idx;
-
-	q1 = get_nth_value(i, nuc_idx, col_stats[i].nuc_stats[nuc_idx].count / 4);
-	q3 = get_nth_value(i, nuc_idx, col_stats[i].nuc_stats[nuc_idx].count * 3 / 4);
-	iqr = q3 - q1;
-
-	left_wisker = q1 - iqr * 3 / 2;
-	right_wisker = q3 + iqr * 3 / 2;
-
-	if (left_wisker < col_stats[i].nuc_stats[nuc_idx].min)
-		left_wisker = col_stats[i].nuc_stats[nuc_idx].min;
-
-	if (right_wisker > col_stats[i].nuc_stats[nuc_idx].max)
-		right_wisker = col_stats[i].nuc_stats[nuc_idx].max;
-
-	if (out_ver == OutputVersion::V1)
-		fprintf(fastx_ctx.out_stream, "%" PRIu64 "\t", i + 1);
-
-	fprintf(fastx_ctx.out_stream, "%" PRIu64 "\t%d\t%d\t%" PRIu64 "\t",
-		col_stats[i].nuc_stats[nuc_idx].count,
-		col_stats[i].nuc_stats[nuc_idx].min,
-		col_stats[i].nuc_stats[nuc_idx].max,
-		col_stats[i].nuc_stats[nuc_idx].sum);
-
-	fprintf(fastx_ctx.out_stream, "%3.2f\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t",
-		(static_cast<double>(col_stats[i].nuc_stats[nuc_idx].sum)) / (static_cast<double>(col_stats[i].nuc_stats[nuc_idx].count)),
-		q1,
-		get_nth_value(i, nuc_idx, col_stats[i].nuc_stats[nuc_idx].count / 2),
-		q3);
-
-	fprintf(fastx_ctx.out_stream, "%" PRId64 "\t%" PRId64 "\t%" PRId64, iqr, left_wisker, right_wisker);
+	while (reader.next_batch(process_record));
 }
 
-void print_v1_stats()
-{
-	fprintf(fastx_ctx.out_stream, "column");
-	print_headers();
-	fprintf(fastx_ctx.out_stream, "\tA_Count\tC_Count\tG_Count\tT_Count\tN_Count\t");
-	fprintf(fastx_ctx.out_stream, "Max_count\n");
-
-	for (size_t i = 0; i < fastx_ctx.max_seq_len; ++i)
-	{
-		if (col_stats[i].nuc_stats[ALL].count == 0)
-			break;
-
-		print_nuc_stats(i, ALL);
-
-		fprintf(fastx_ctx.out_stream, "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t",
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::A)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::C)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::G)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::T)].count,
-			col_stats[i].nuc_stats[static_cast<int>(Nucleotide::N)].count);
-
-		fprintf(fastx_ctx.out_stream, "%" PRIu64 "\n", col_stats[0].nuc_stats[ALL].count);
-	}
-}
-
-void print_v2_stats()
+void print_stats()
 {
-	fprintf(fastx_ctx.out_stream, "cycle\tmax_count");
-
-	for (int i = 0; i < NUC_CHARS.size(); ++i)
-		print_headers(static_cast<Nucleotide>(i));
-
-	fprintf(fastx_ctx.out_stream, "\n");
+	FASTX_TRACE_SCOPE("report");
+	FASTX_PERF_SCOPE(PERF_STAGE_OUTPUT);
+	size_t num_rows = get_report_rows(col_stats);
+	string buf;
 
-	uint64_t max_count = col_stats[0].nuc_stats[static_cast<int>(Nucleotide::ALL)].count;
+	format_report_header(&buf, out_ver);
 
-	for (size_t i = 0; i < fastx_ctx.max_seq_len; ++i)
+	for (size_t i = 0; i < num_rows; i += REPORT_BLOCK_ROWS)
 	{
-		if (col_stats[i].nuc_stats[ALL].count == 0)
-			break;
-
-		fprintf(fastx_ctx.out_stream, "%zd\t%zd\t", i + 1, max_count);
-
-		for (int j = 0; j < NUC_CHARS.size(); ++j)
-			print_nuc_stats(i, static_cast<uint8_t>(j));
-
-		fprintf(fastx_ctx.out_stream, "\n");
+		format_report_rows(&buf, col_stats, i, min(i + REPORT_BLOCK_ROWS, num_rows), out_ver, min_qual);
+		fwrite(buf.data(), 1, buf.size(), fastx_ctx.out_stream);
+		buf.clear();
 	}
-}
 
-void print_stats()
-{
-	if (out_ver == OutputVersion::V1)
-		print_v1_stats();
-	else
-		print_v2_stats();
+	fwrite(buf.data(), 1, buf.size(), fastx_ctx.out_stream);
 }
 
 int main(int argc, char** argv)
@@ -362,16 +186,27 @@ int main(int argc, char** argv)
 	{
 		ios::sync_with_stdio(false);
 		parse_args(argc, argv);
-		init_vals();
 
-		alloc_bufs();
+		if (!trace_path.empty())
+			trace_start();
+
+		if (perf_counters)
+			perf_start();
+
 		open_files();
 
 		read_records();
+		write_index(&fastx_ctx);
 		print_stats();
 
 		close_files();
 		free_bufs();
+
+		if (!trace_path.empty())
+			trace_write(trace_path);
+
+		if (perf_counters)
+			perf_report(stderr);
 	}
 	catch (const exception& e)
 	{
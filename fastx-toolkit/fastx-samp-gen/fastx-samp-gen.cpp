@@ -1,32 +1,36 @@
+#include <charconv>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
 #include <format>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <string>
+#include <thread>
 #include <vector>
 #include "args.hxx"
 #include "fastx.hpp"
+#include "fastx-writer.hpp"
+#include "perf-counters.hpp"
+#include "sample-gen.hpp"
+#include "sample-profile.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
-enum class Nucleotide : unsigned char
-{
-	ALL, A, C, G, T, N,
-	_NUCLEOTIDE_COUNT_
-};
-
-static const vector<char> NUC_CHARS = { '\0', 'A', 'C', 'G', 'T', 'N' };
-
 /* Argument parser constants */
 static const char* PROLOGUE = "";
 static const char* EPILOGUE = "";
 
 /* I/O variables */
 static FILE* out_fp = stdout;
-static char* out_buf;
-static uint64_t out_buf_pos = 0;
+static unique_ptr<FastxWriter> writer;
 
 /* Argument variables */
+static string trace_path;
+static bool perf_counters = false;
 static FileFormat file_format = FileFormat::FILE_FORMAT_UNKNOWN;
 static int num_records = 0;
 static bool collapse_record = false;
@@ -41,14 +45,17 @@ static int min_seq_len = 1;
 static int max_seq_len = 50;
 
 static size_t out_buf_size = 32768;
+static size_t num_out_bufs = NUM_OUT_BUFS;
+
+static uint64_t seed = 0;
+static size_t num_threads = max(thread::hardware_concurrency(), 1u);
+
+static string profile_path;
+static string save_profile_path;
 
 /* Random variables */
-static random_device rd;
-static mt19937 mt(rd());
-static uniform_int_distribution<> alphabet_dist('A', 'Z');
-static uniform_int_distribution<> nuc_dist(static_cast<int>(Nucleotide::A), static_cast<int>(Nucleotide::N) - 1);
 static uniform_int_distribution<> seq_len_dist;
-static uniform_int_distribution<> qual_dist;
+static unique_ptr<ProfileSampler> profile_sampler;
 
 void valid_args()
 {
@@ -60,6 +67,9 @@ void valid_args()
 	result &= min_qual < max_qual;
 	result &= min_qual < max_qual;
 
+	result &= out_buf_size > 0 && num_out_bufs >= 2;
+	result &= num_threads > 0;
+	result &= save_profile_path.empty() || !profile_path.empty();
 	result &= min_seq_len > 0 && max_seq_len > 0 && min_seq_len <= max_seq_len && max_seq_len <= MAX_SEQUENCE_LENGTH;
 
 	if (!result)
@@ -79,6 +89,8 @@ void parse_args(int argc, char** argv)
 	args::Flag cr_arg(parser, "cr", "collapse record. only supported to fastq", { 'c' }, collapse_record);
 	args::Flag use_crlf_arg(parser, "crlf", format("use crlf. default is {}", use_crlf), { "crlf" }, use_crlf);
 	args::ValueFlag<string> out_arg(parser, "out", "output file name. default is STDOUT", { 'o' }, out_name);
+	args::ValueFlag<uint64_t> seed_arg(parser, "seed", "random seed. the output depends only on the seed and the other options. default is random", { "seed" });
+	args::ValueFlag<size_t> ths_arg(parser, "ths", format("number of generator threads. default is {}", num_threads), { "ths", "threads" }, num_threads);
 
 	args::Group qual_group(parser, "Quality");
 	args::ValueFlag<char> bq_arg(qual_group, "bq", format("base quality offset. default is {}", static_cast<int>(base_qual_offset)), { "bq" }, base_qual_offset);
@@ -89,18 +101,31 @@ void parse_args(int argc, char** argv)
 	args::ValueFlag<int> mns_arg(seq_group, "mns", format("min seq length. default is {}", min_seq_len), { "mns" }, min_seq_len);
 	args::ValueFlag<int> mxs_arg(seq_group, "mxs", format("max seq length. max length is {}. default is {}", MAX_SEQUENCE_LENGTH, max_seq_len), { "mxs" }, max_seq_len);
 
+	args::Group profile_group(parser, "Profile");
+	args::ValueFlag<string> profile_arg(profile_group, "profile", "generate reads matching a profile spec file or a fastx-qual-stats v2 output", { "profile" }, profile_path);
+	args::ValueFlag<string> save_profile_arg(profile_group, "save-profile", "write the loaded profile as a spec file", { "save-profile" }, save_profile_path);
+
 	args::Group io_tuning_group(parser, "I/O Tuning");
 	args::ValueFlag<size_t> obufs_arg(io_tuning_group, "obufs", format("output buffer size. default is {}", out_buf_size), { "obufs" }, out_buf_size);
+	args::ValueFlag<size_t> obufn_arg(io_tuning_group, "obufn", format("number of output buffers written in the background. default is {}", num_out_bufs), { "obufn" }, num_out_bufs);
+
+	args::Group diag_group(parser, "Diagnostics");
+	args::ValueFlag<string> trace_arg(diag_group, "trace", "write a Chrome trace JSON timeline to the file", { "trace" }, trace_path);
+	args::Flag perf_arg(diag_group, "perf-counters", "print hardware counters per processing stage to STDERR. default is false", { "perf-counters" }, perf_counters);
 
 	try
 	{
 		parser.ParseCLI(argc, argv);
+		trace_path = args::get(trace_arg);
+		perf_counters = perf_arg;
 
 		file_format = args::get(sf_arg);
 		num_records = args::get(nr_arg);
 		collapse_record = args::get(cr_arg);
 		use_crlf = args::get(use_crlf_arg);
 		out_name = args::get(out_arg);
+		seed = seed_arg ? args::get(seed_arg) : (static_cast<uint64_t>(random_device()()) << 32 | random_device()());
+		num_threads = args::get(ths_arg);
 
 		base_qual_offset = args::get(bq_arg);
 		min_qual = args::get(mnq_arg);
@@ -109,7 +134,11 @@ void parse_args(int argc, char** argv)
 		min_seq_len = args::get(mns_arg);
 		max_seq_len = args::get(mxs_arg);
 
+		profile_path = args::get(profile_arg);
+		save_profile_path = args::get(save_profile_arg);
+
 		out_buf_size = args::get(obufs_arg);
+		num_out_bufs = args::get(obufn_arg);
 
 		valid_args();
 	}
@@ -121,133 +150,271 @@ void parse_args(int argc, char** argv)
 	}
 }
 
-void alloc_bufs()
+void append_number(string& buf, size_t num)
 {
-	out_buf = new char[out_buf_size];
+	char num_buf[24];
+	to_chars_result result = to_chars(num_buf, num_buf + sizeof(num_buf), num);
+
+	buf.append(num_buf, result.ptr - num_buf);
 }
 
-void free_bufs()
+void append_line_break(string& buf)
 {
-	if(out_buf) delete[] out_buf;
+	if (use_crlf)
+		buf += CARRIAGE_RETN;
+
+	buf += LINE_FEED;
 }
 
-void append_rand_chars(string& str, size_t len, uniform_int_distribution<>& dist)
+char* append_space(string& buf, size_t len)
 {
-	for (size_t i = 0; i < len; ++i)
-		str += static_cast<char>(dist(mt));
+	size_t pos = buf.size();
+
+	buf.resize(pos + len);
+
+	return buf.data() + pos;
 }
 
-void gen_seq_id(string& seq_id, int seq_ord, size_t seq_len)
-{	
-	seq_id += FILE_SIGNATURES[static_cast<int>(file_format)];
-	
+void gen_seq_id(string& buf, SampleRng& rng, size_t seq_ord, size_t seq_len)
+{
+	buf += FILE_SIGNATURES[static_cast<int>(file_format)];
+
 	if (file_format == FileFormat::FILE_FORMAT_FASTA)
 	{
-		seq_id += "sequence";
-		seq_id += to_string(seq_ord);
+		buf += "sequence";
+		append_number(buf, seq_ord);
 	}
 
 	else if (file_format == FileFormat::FILE_FORMAT_FASTQ)
 	{
-		append_rand_chars(seq_id, 15, alphabet_dist);
-		seq_id += ".";
-		seq_id += to_string(seq_ord);
+		gen_rand_chars(append_space(buf, 15), 15, rng, 'A', 'Z');
+		buf += '.';
+		append_number(buf, seq_ord);
 
 		if (collapse_record)
 		{
-			append_rand_chars(seq_id, 4, alphabet_dist);
-			seq_id += '-';
-			append_rand_chars(seq_id, 4, alphabet_dist);
+			gen_rand_chars(append_space(buf, 4), 4, rng, 'A', 'Z');
+			buf += '-';
+			gen_rand_chars(append_space(buf, 4), 4, rng, 'A', 'Z');
 		}
 
-		seq_id += " length=";
-		seq_id += to_string(seq_len);
+		buf += " length=";
+		append_number(buf, seq_len);
 	}
 }
 
-void gen_seq(string& seq, size_t seq_len)
+// Block block_idx always draws from the same stream, whichever thread generates it
+void gen_block(size_t block_idx, string& buf)
 {
-	for (size_t i = 0; i < seq_len; ++i)
-		seq += NUC_CHARS[nuc_dist(mt)];
-}
+	FASTX_TRACE_SCOPE("generate");
+	FASTX_PERF_SCOPE(PERF_STAGE_GENERATE);
 
-void gen_qual(string& qual, size_t qual_len)
-{
-	append_rand_chars(qual, qual_len, qual_dist);
-}
+	SampleRng rng(seed, block_idx);
+	uniform_int_distribution<> block_seq_len_dist = seq_len_dist;
+	uint8_t min_qual_char = static_cast<uint8_t>(base_qual_offset - min_qual);
+	uint8_t max_qual_char = static_cast<uint8_t>(base_qual_offset + max_qual);
+	size_t first = block_idx * GEN_BLOCK_RECORDS;
+	size_t last = min(first + GEN_BLOCK_RECORDS, static_cast<size_t>(num_records));
+	const ProfileSampler* sampler = profile_sampler.get();
+	vector<pair<size_t, size_t>> seq_spans; // Sequences of the block that duplicates copy
 
-void flush_out_buf()
-{
-	fwrite(out_buf, sizeof(char), out_buf_pos, out_fp);
-	out_buf_pos = 0;
+	buf.clear();
+
+	for (size_t i = first; i < last; ++i)
+	{
+		const pair<size_t, size_t>* dup_span = nullptr;
+		size_t seq_len;
+
+		if (sampler && sampler->has_duplicates() && !seq_spans.empty() && sampler->draw_duplicate(rng))
+			dup_span = &seq_spans[rng() % seq_spans.size()];
+
+		if (dup_span)
+			seq_len = dup_span->second;
+		else if (sampler && sampler->has_lengths())
+			seq_len = sampler->draw_len(rng);
+		else
+			seq_len = static_cast<size_t>(block_seq_len_dist(rng));
+
+		gen_seq_id(buf, rng, i, seq_len);
+		append_line_break(buf);
+
+		size_t seq_pos = buf.size();
+		char* seq = append_space(buf, seq_len);
+
+		if (dup_span)
+			memcpy(seq, buf.data() + dup_span->first, seq_len);
+		else if (sampler)
+			sampler->gen_nucs(seq, seq_len, rng);
+		else
+			gen_rand_nucs(seq, seq_len, rng);
+
+		if (sampler && sampler->has_duplicates())
+			seq_spans.emplace_back(seq_pos, seq_len);
+
+		append_line_break(buf);
+
+		if (file_format == FileFormat::FILE_FORMAT_FASTQ)
+		{
+			buf += '+';
+			append_line_break(buf);
+
+			char* qual = append_space(buf, seq_len);
+
+			if (sampler)
+				sampler->gen_quals(qual, buf.data() + seq_pos, seq_len, rng);
+			else
+				gen_rand_chars(qual, seq_len, rng, min_qual_char, max_qual_char);
+
+			append_line_break(buf);
+		}
+	}
 }
 
-void write_rec(const string& rec)
+// Workers generate blocks into a window of slots; the calling thread writes them in block order
+void gen_blocks_parallel(size_t num_blocks)
 {
-	size_t curr_pos = 0;
-	size_t remaining_size = rec.size();
+	typedef struct GenSlot_s
+	{
+		string data;
+		bool ready = false;
+	} GenSlot_t;
+
+	vector<GenSlot_t> slots(num_threads * 2);
+	vector<thread> workers;
+	mutex mtx;
+	condition_variable cv;
+	size_t next_block = 0;
+	size_t num_written = 0;
+	bool stop = false;
+	exception_ptr error;
+
+	auto worker = [&]()
+		{
+			FASTX_TRACE_THREAD("generator");
 
-	while (remaining_size > 0)
+			while (true)
+			{
+				size_t block_idx;
+
+				{
+					unique_lock<mutex> lock(mtx);
+
+					if (stop || next_block == num_blocks)
+						return;
+
+					block_idx = next_block++;
+
+					// The slot is free once the block one window earlier is written
+					cv.wait(lock, [&] { return stop || block_idx < num_written + slots.size(); });
+
+					if (stop)
+						return;
+				}
+
+				GenSlot_t& slot = slots[block_idx % slots.size()];
+
+				try
+				{
+					gen_block(block_idx, slot.data);
+				}
+				catch (...)
+				{
+					lock_guard<mutex> lock(mtx);
+					error = current_exception();
+					stop = true;
+				}
+
+				{
+					lock_guard<mutex> lock(mtx);
+					slot.ready = true;
+				}
+
+				cv.notify_all();
+			}
+		};
+
+	for (size_t i = 0; i < min(num_threads, num_blocks); ++i)
+		workers.emplace_back(worker);
+
+	try
 	{
-		size_t copy_size = remaining_size <= out_buf_size ? remaining_size : out_buf_size;
-		
-		if (copy_size + out_buf_pos >= out_buf_size)
-			copy_size = out_buf_size - out_buf_pos;
+		for (size_t i = 0; i < num_blocks; ++i)
+		{
+			GenSlot_t& slot = slots[i % slots.size()];
+
+			{
+				FASTX_TRACE_SCOPE("wait_block");
+				unique_lock<mutex> lock(mtx);
+				cv.wait(lock, [&] { return stop || slot.ready; });
+
+				if (error)
+					break;
+			}
 
-		copy(rec.begin() + curr_pos, rec.begin() + curr_pos + copy_size, out_buf + out_buf_pos);
+			writer->write(slot.data);
 
-		remaining_size = remaining_size >= copy_size ? remaining_size - copy_size : copy_size - remaining_size;
-		out_buf_pos += copy_size;
-		curr_pos += copy_size;
+			{
+				lock_guard<mutex> lock(mtx);
+				slot.ready = false;
+				num_written++;
+			}
 
-		if(out_buf_pos == out_buf_size)
-			flush_out_buf();
+			cv.notify_all();
+		}
+	}
+	catch (...)
+	{
+		lock_guard<mutex> lock(mtx);
+		error = current_exception();
 	}
-}
 
-void append_line_break(string& str)
-{
-	const string new_line = use_crlf ? "\r\n" : "\n";
-	str += new_line;
+	{
+		lock_guard<mutex> lock(mtx);
+		stop = true;
+	}
+
+	cv.notify_all();
+
+	for (thread& worker_thread : workers)
+		worker_thread.join();
+
+	if (error)
+		rethrow_exception(error);
 }
 
 void gen_recs()
 {
-	string rec_buf;
-	size_t rec_buf_size = 0;
-	uint8_t rec_mem_cnt = RECORD_MEMBER_COUNTS[static_cast<uint8_t>(file_format)];
-
-	rec_buf_size = MAX_SEQUENCE_LENGTH * rec_mem_cnt;
-	rec_buf_size += static_cast<size_t>(use_crlf ? 2 : 1) * rec_mem_cnt;
-	rec_buf.reserve(rec_buf_size);
+	size_t num_blocks = (static_cast<size_t>(num_records) + GEN_BLOCK_RECORDS - 1) / GEN_BLOCK_RECORDS;
 
 	seq_len_dist.param(uniform_int_distribution<>::param_type(min_seq_len, max_seq_len));
-	qual_dist.param(uniform_int_distribution<>::param_type(base_qual_offset - min_qual, base_qual_offset + max_qual));
 
-	for (int i = 0; i < num_records; ++i)
+	if (!profile_path.empty())
 	{
-		int seq_len = seq_len_dist(mt);
+		SampleProfile_t profile;
 
-		gen_seq_id(rec_buf, i, seq_len);
-		append_line_break(rec_buf);
+		load_profile(profile_path, &profile);
 
-		gen_seq(rec_buf, seq_len);
-		append_line_break(rec_buf);
+		if (!save_profile_path.empty())
+			save_profile(save_profile_path, profile);
 
-		if (file_format == FileFormat::FILE_FORMAT_FASTQ)
-		{
-			rec_buf += '+';
-			append_line_break(rec_buf);
+		// Like the uniform qualities, the fallback range is [BQ + |MNQ|, BQ + MXQ]
+		profile_sampler = make_unique<ProfileSampler>(profile, -min_qual, max_qual, base_qual_offset);
+	}
 
-			gen_qual(rec_buf, seq_len);
-			append_line_break(rec_buf);
-		}
+	if (num_threads > 1 && num_blocks > 1)
+		gen_blocks_parallel(num_blocks);
+	else
+	{
+		string buf;
 
-		write_rec(rec_buf);
-		rec_buf.clear();
+		for (size_t i = 0; i < num_blocks; ++i)
+		{
+			gen_block(i, buf);
+			writer->write(buf);
+		}
 	}
 
-	flush_out_buf();
+	writer->flush();
 }
 
 int main(int argc, char** argv)
@@ -257,13 +424,25 @@ int main(int argc, char** argv)
 		ios::sync_with_stdio(false);
 		parse_args(argc, argv);
 
+		if (!trace_path.empty())
+			trace_start();
+
+		if (perf_counters)
+			perf_start();
+
 		open_file(out_name.c_str(), "wb", &out_fp);
-		alloc_bufs();
+		writer = make_unique<FastxWriter>(out_fp, out_buf_size, num_out_bufs);
 
 		gen_recs();
 
-		free_bufs();
+		writer.reset();
 		close_file(out_fp);
+
+		if (!trace_path.empty())
+			trace_write(trace_path);
+
+		if (perf_counters)
+			perf_report(stderr);
 	}
 	catch (const exception& e)
 	{
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <format>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include "column-stats.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FASTX_COLUMN_STATS_X86
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+void init_nuc_idxs(int* nuc_idxs)
+{
+	for (int i = 0; i < NUC_CHARS.size(); ++i)
+	{
+		nuc_idxs[static_cast<uint8_t>(NUC_CHARS[i])] = i;
+		nuc_idxs[static_cast<uint8_t>(tolower(NUC_CHARS[i]))] = i;
+	}
+}
+
+// Bases of a read are turned into counter offsets within their column in blocks, then added with one increment
+// each. Every base of a read lands in its own column, so the increments of a block never conflict.
+constexpr size_t SLOT_BLOCK = 256;
+
+static_assert(ColumnStatsStore::COLUMN_STRIDE <= UINT16_MAX, "Counter offsets must fit 16 bits");
+
+static const array<uint8_t, numeric_limits<uint8_t>::max() + 1> NUC_CLASSES = []()
+	{
+		int nuc_idxs[numeric_limits<uint8_t>::max() + 1] = { 0 };
+		array<uint8_t, numeric_limits<uint8_t>::max() + 1> classes;
+
+		init_nuc_idxs(nuc_idxs);
+
+		for (size_t i = 0; i < classes.size(); ++i)
+			classes[i] = static_cast<uint8_t>(nuc_idxs[i]);
+
+		return classes;
+	}();
+
+// The get_slots kernels return false when a quality falls outside the buckets; its slot is then invalid
+static bool get_slots_scalar(const char* seq, const char* qual, size_t len, uint8_t qual_base, uint16_t* slots)
+{
+	bool valid = true;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		size_t slot = qual ? static_cast<uint8_t>(qual[i] - qual_base) : ColumnStatsStore::COUNT_SLOT;
+
+		valid &= !qual || slot < QUALITY_BUCKET_COUNT;
+		slots[i] = static_cast<uint16_t>(NUC_CLASSES[static_cast<uint8_t>(seq[i])] * ColumnStatsStore::NUC_STRIDE + slot);
+	}
+
+	return valid;
+}
+
+#ifdef FASTX_COLUMN_STATS_X86
+// Matches init_nuc_idxs: clearing bit 5 folds lower case onto upper case and no other byte onto ACGTN
+static inline __m128i get_nuc_classes_sse2(__m128i seq)
+{
+	__m128i upper = _mm_and_si128(seq, _mm_set1_epi8(static_cast<char>(0xDF)));
+	__m128i a = _mm_and_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('A')), _mm_set1_epi8(static_cast<char>(Nucleotide::A)));
+	__m128i c = _mm_and_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('C')), _mm_set1_epi8(static_cast<char>(Nucleotide::C)));
+	__m128i g = _mm_and_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('G')), _mm_set1_epi8(static_cast<char>(Nucleotide::G)));
+	__m128i t = _mm_and_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('T')), _mm_set1_epi8(static_cast<char>(Nucleotide::T)));
+	__m128i n = _mm_and_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('N')), _mm_set1_epi8(static_cast<char>(Nucleotide::N)));
+
+	return _mm_or_si128(_mm_or_si128(_mm_or_si128(a, c), _mm_or_si128(g, t)), n);
+}
+
+// 16 bases at a time: one subtract decodes the qualities, one multiply-add gives the offsets
+static bool get_slots_sse2(const char* seq, const char* qual, size_t len, uint8_t qual_base, uint16_t* slots)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i stride = _mm_set1_epi16(static_cast<short>(ColumnStatsStore::NUC_STRIDE));
+	__m128i max_bucket = _mm_set1_epi8(static_cast<char>(QUALITY_BUCKET_COUNT - 1));
+	__m128i buckets = _mm_set1_epi8(static_cast<char>(ColumnStatsStore::COUNT_SLOT));
+	__m128i invalid = zero;
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i classes = get_nuc_classes_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i)));
+
+		if (qual)
+		{
+			buckets = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(qual + i)), _mm_set1_epi8(static_cast<char>(qual_base)));
+
+			// Unsigned buckets > max_bucket: the minimum differs from the bucket
+			invalid = _mm_or_si128(invalid, _mm_xor_si128(_mm_cmpeq_epi8(_mm_min_epu8(buckets, max_bucket), buckets), _mm_set1_epi8(-1)));
+		}
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(classes, zero), stride), _mm_unpacklo_epi8(buckets, zero));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(classes, zero), stride), _mm_unpackhi_epi8(buckets, zero));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(slots + i), lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(slots + i + 8), hi);
+	}
+
+	bool valid = get_slots_scalar(seq + i, qual ? qual + i : nullptr, len - i, qual_base, slots + i);
+
+	return valid && _mm_movemask_epi8(invalid) == 0;
+}
+#endif
+
+static bool get_slots(const char* seq, const char* qual, size_t len, uint8_t qual_base, uint16_t* slots)
+{
+#ifdef FASTX_COLUMN_STATS_X86
+	return get_slots_sse2(seq, qual, len, qual_base, slots);
+#else
+	return get_slots_scalar(seq, qual, len, qual_base, slots);
+#endif
+}
+
+template <typename T>
+static void add_slots(T* counters, const uint16_t* slots, size_t len, T read_count)
+{
+	for (size_t i = 0; i < len; ++i, counters += ColumnStatsStore::COLUMN_STRIDE)
+		counters[slots[i]] += read_count;
+}
+
+void ColumnStatsStore::resize(size_t num_cols)
+{
+	if (num_cols <= this->num_cols)
+		return;
+
+	if (wide)
+		wide_counters.resize(num_cols * COLUMN_STRIDE);
+	else
+		counters.resize(num_cols * COLUMN_STRIDE);
+
+	this->num_cols = num_cols;
+}
+
+void ColumnStatsStore::reserve_reads(uint64_t read_count)
+{
+	num_reads += read_count;
+
+	if (!wide && num_reads > UINT32_MAX)
+		promote();
+}
+
+void ColumnStatsStore::promote()
+{
+	wide_counters.assign(counters.begin(), counters.end());
+	counters = vector<uint32_t>();
+	wide = true;
+}
+
+void ColumnStatsStore::add_record(const FastxRecordView_t& record, char base_qual_offset)
+{
+	uint16_t slots[SLOT_BLOCK];
+	uint8_t qual_base = static_cast<uint8_t>(base_qual_offset + MIN_QUALITY);
+
+	reserve_reads(record.read_count);
+	resize(record.seq_len);
+
+	for (size_t i = 0; i < record.seq_len; i += SLOT_BLOCK)
+	{
+		size_t len = min(SLOT_BLOCK, record.seq_len - i);
+
+		if (!get_slots(record.seq + i, record.qual ? record.qual + i : nullptr, len, qual_base, slots))
+		{
+			// Find the first invalid quality for the message
+			size_t col_idx = i;
+
+			while (is_valid_quality(record.qual[col_idx] - base_qual_offset))
+				col_idx++;
+
+			throw runtime_error(format("Invalid quality: qual={}, col_idx={}", record.qual[col_idx] - base_qual_offset, col_idx));
+		}
+
+		if (wide)
+			add_slots<uint64_t>(wide_counters.data() + i * COLUMN_STRIDE, slots, len, record.read_count);
+		else
+			add_slots<uint32_t>(counters.data() + i * COLUMN_STRIDE, slots, len, record.read_count);
+	}
+}
+
+bool ColumnStatsStore::has_bases(size_t col_idx) const
+{
+	size_t base = col_idx * COLUMN_STRIDE;
+
+	if (wide)
+		return any_of(wide_counters.begin() + base, wide_counters.begin() + base + COLUMN_STRIDE, [](uint64_t n) { return n > 0; });
+
+	return any_of(counters.begin() + base, counters.begin() + base + COLUMN_STRIDE, [](uint32_t n) { return n > 0; });
+}
+
+uint64_t ColumnStatsStore::get_count(size_t col_idx, uint8_t nuc_idx) const
+{
+	uint64_t count = 0;
+
+	for (uint8_t i = 0; i < NUCLEOTIDE_COUNT; ++i)
+	{
+		if (nuc_idx != ALL && i != nuc_idx)
+			continue;
+
+		size_t base = col_idx * COLUMN_STRIDE + i * NUC_STRIDE;
+		uint64_t weight = nuc_idx == ALL && i == ALL ? 2 : 1;
+
+		for (size_t j = 0; j <= COUNT_SLOT; ++j)
+			count += get_counter(base + j) * weight;
+	}
+
+	return count;
+}
+
+template <typename T>
+static void load_histogram(NucleotideStatistics* stats, const T* counters)
+{
+	for (size_t i = 0; i < QUALITY_BUCKET_COUNT; ++i)
+		stats->base_counts[i] = counters[i];
+
+	stats->count = counters[ColumnStatsStore::COUNT_SLOT];
+}
+
+// Bases with qualities come from single reads, so each one adds its quality to the sum once
+static void derive_stats(NucleotideStatistics* stats)
+{
+	uint64_t total = 0;
+
+	stats->min = 100;
+	stats->max = -100;
+	stats->sum = 0;
+
+	for (size_t i = 0; i < QUALITY_BUCKET_COUNT; ++i)
+	{
+		uint64_t n = stats->base_counts[i];
+		int qual = static_cast<int>(i) + MIN_QUALITY;
+
+		total += n;
+		stats->cum_counts[i] = total;
+		stats->sum += static_cast<uint64_t>(qual) * n;
+
+		if (n > 0)
+		{
+			stats->min = min(stats->min, qual);
+			stats->max = qual;
+		}
+	}
+
+	stats->count += total;
+}
+
+void ColumnStatsStore::get_column_stats(size_t col_idx, NucleotideStatistics* stats) const
+{
+	if (col_idx >= num_cols)
+		throw out_of_range(format("Invalid range: col_idx={}", col_idx));
+
+	for (size_t i = 0; i < NUCLEOTIDE_COUNT; ++i)
+	{
+		size_t base = col_idx * COLUMN_STRIDE + i * NUC_STRIDE;
+
+		if (wide)
+			load_histogram(&stats[i], wide_counters.data() + base);
+		else
+			load_histogram(&stats[i], counters.data() + base);
+	}
+
+	// The ALL histogram only holds bases outside ACGTN, which count twice
+	NucleotideStatistics& all = stats[ALL];
+
+	for (size_t j = 0; j < QUALITY_BUCKET_COUNT; ++j)
+		all.base_counts[j] *= 2;
+
+	all.count *= 2;
+
+	for (size_t i = 1; i < NUCLEOTIDE_COUNT; ++i)
+	{
+		for (size_t j = 0; j < QUALITY_BUCKET_COUNT; ++j)
+			all.base_counts[j] += stats[i].base_counts[j];
+
+		all.count += stats[i].count;
+	}
+
+	for (size_t i = 0; i < NUCLEOTIDE_COUNT; ++i)
+		derive_stats(&stats[i]);
+}
+
+void ColumnStatsStore::merge(const ColumnStatsStore& src)
+{
+	resize(src.num_cols);
+	reserve_reads(src.num_reads);
+
+	size_t len = src.num_cols * COLUMN_STRIDE;
+
+	if (wide && src.wide)
+		transform(src.wide_counters.begin(), src.wide_counters.begin() + len, wide_counters.begin(), wide_counters.begin(), plus<uint64_t>());
+	else if (wide)
+		transform(src.counters.begin(), src.counters.begin() + len, wide_counters.begin(), wide_counters.begin(), plus<uint64_t>());
+	else
+		transform(src.counters.begin(), src.counters.begin() + len, counters.begin(), counters.begin(), plus<uint32_t>());
+}
+
+void ColumnStatsStore::clear()
+{
+	counters = vector<uint32_t>();
+	wide_counters = vector<uint64_t>();
+	num_reads = 0;
+	num_cols = 0;
+	wide = false;
+}
+
+int64_t get_nth_value(const NucleotideStatistics& stats, uint64_t q, int min_qual)
+{
+	if (q == 0)
+		return stats.min;
+
+	if (q >= stats.count)
+		throw out_of_range(format("Invalid range: quantile={}", q));
+
+	// The first bucket whose cumulative count passes q holds the q-th base
+	const uint64_t* pos = upper_bound(stats.cum_counts, stats.cum_counts + QUALITY_BUCKET_COUNT, q);
+
+	return (pos - stats.cum_counts) + min_qual;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "fastx.hpp"
+
+using namespace std;
+
+enum class Nucleotide : uint8_t
+{
+	ALL, A, C, G, T, N,
+	_NUCLEOTIDE_COUNT_,
+	UNDEFINED
+};
+
+constexpr uint8_t ALL = static_cast<uint8_t>(Nucleotide::ALL);
+constexpr size_t NUCLEOTIDE_COUNT = static_cast<size_t>(Nucleotide::_NUCLEOTIDE_COUNT_);
+constexpr size_t QUALITY_BUCKET_COUNT = MAX_QUALITY - MIN_QUALITY + 1;
+
+const vector<char> NUC_CHARS = { '\0', 'A', 'C', 'G', 'T', 'N' };
+
+// Qualities outside the histogram buckets would be counted in another histogram
+inline bool is_valid_quality(int qual)
+{
+	return qual >= MIN_QUALITY && qual <= MAX_QUALITY;
+}
+
+// Statistics of one nucleotide class in one column, derived from a ColumnStatsStore for output
+struct NucleotideStatistics
+{
+	int min = 100;
+	int max = -100;
+	uint64_t sum = 0;
+	uint64_t count = 0;
+	uint64_t base_counts[QUALITY_BUCKET_COUNT] = { 0 };
+	uint64_t cum_counts[QUALITY_BUCKET_COUNT] = { 0 }; // Bases up to each bucket, for quantiles
+};
+
+// Maps upper and lower case nucleotides to their Nucleotide index; other characters map to ALL
+void init_nuc_idxs(int* nuc_idxs);
+
+// Per-column counters that grow with the longest read. A column is one contiguous run of a quality histogram
+// per nucleotide plus the count of bases without qualities, so min, max, sum and count are derived at output time.
+// The ALL histogram holds bases outside ACGTN; the ALL statistics are derived from every histogram, with those
+// bases counted twice as they always have been. Counters stay 32-bit until the reads added could overflow one,
+// then the store is promoted to 64-bit.
+class ColumnStatsStore
+{
+public:
+	static constexpr size_t COUNT_SLOT = QUALITY_BUCKET_COUNT; // Bases without qualities
+	static constexpr size_t NUC_STRIDE = (QUALITY_BUCKET_COUNT + 1 + 3) & ~static_cast<size_t>(3); // 16-byte aligned
+	static constexpr size_t COLUMN_STRIDE = NUCLEOTIDE_COUNT * NUC_STRIDE;
+	static constexpr size_t COLUMN_BYTES = COLUMN_STRIDE * sizeof(uint32_t); // Before promotion
+
+	size_t size() const { return num_cols; }
+	bool empty() const { return num_cols == 0; }
+	bool is_wide() const { return wide; }
+
+	// Never shrinks
+	void resize(size_t num_cols);
+
+	// Promotes the counters if read_count more reads could overflow them. Call before adding the reads.
+	void reserve_reads(uint64_t read_count);
+
+	// nuc_idx comes from init_nuc_idxs and qual must pass is_valid_quality. The column must exist and the read
+	// must be reserved.
+	void add_base(size_t col_idx, uint8_t nuc_idx, int qual, uint32_t read_count, bool has_qual)
+	{
+		size_t idx = col_idx * COLUMN_STRIDE + nuc_idx * NUC_STRIDE + (has_qual ? qual - MIN_QUALITY : COUNT_SLOT);
+
+		if (wide)
+			wide_counters[idx] += read_count;
+		else
+			counters[idx] += read_count;
+	}
+
+	// Adds every base of the read, growing the store to it. Throws runtime_error on a quality outside the buckets.
+	void add_record(const FastxRecordView_t& record, char base_qual_offset);
+
+	// Stops at the first non-zero counter, so it is cheaper than get_count
+	bool has_bases(size_t col_idx) const;
+
+	uint64_t get_count(size_t col_idx, uint8_t nuc_idx) const;
+
+	// Fills the statistics of every nucleotide of a column, indexed by Nucleotide, reading each histogram once.
+	// Throws out_of_range past the longest read.
+	void get_column_stats(size_t col_idx, NucleotideStatistics* stats) const;
+
+	void merge(const ColumnStatsStore& src);
+
+	// Frees the counters
+	void clear();
+
+private:
+	uint64_t get_counter(size_t idx) const { return wide ? wide_counters[idx] : counters[idx]; }
+	void promote();
+
+	vector<uint32_t> counters;
+	vector<uint64_t> wide_counters; // Replaces counters after promotion
+	uint64_t num_reads = 0; // Bounds every counter: a read adds to a counter at most once
+	size_t num_cols = 0;
+	bool wide = false;
+};
+
+// Quality of the q-th base in ascending order, found by binary search over cum_counts. Bucket 0 is reported
+// as min_qual; without qualities the result is one past the last bucket.
+int64_t get_nth_value(const NucleotideStatistics& stats, uint64_t q, int min_qual);
@@ -0,0 +1,381 @@
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include "fastx-reader.hpp"
+#include "fxb.hpp"
+#include "fxi.hpp"
+#include "line-index.hpp"
+#include "perf-counters.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+FastxReader::FastxReader(FastxContext_t* ctx, size_t buf_size, size_t batch_size) : ctx(ctx), max_line_len(ctx->long_reads ? SIZE_MAX : ctx->max_seq_len), records(batch_size)
+{
+	if (ctx->format == FileFormat::FILE_FORMAT_UNKNOWN)
+		throw runtime_error("Unknown file format");
+
+	if (batch_size == 0)
+		throw invalid_argument("Batch size must be positive");
+
+	if (ctx->index && (ctx->packed || ctx->source))
+		throw invalid_argument("Offset index needs uncompressed text input");
+
+	if (ctx->packed)
+	{
+		ByteRange_t blocks = get_fxb_blocks(ctx->map_base, ctx->map_size);
+
+		packed_pos = ctx->map_base + blocks.begin;
+		packed_end = ctx->map_base + blocks.end;
+	}
+	else if (ctx->map_base)
+	{
+		block = ctx->map_base;
+		block_size = ctx->map_size;
+		eof = true;
+	}
+	else
+	{
+		InputSource* source = ctx->source;
+
+		if (!source)
+		{
+			file_source = make_unique<FileSource>(ctx->in_stream);
+			source = file_source.get();
+		}
+
+		read_ahead = make_unique<ReadAhead>(source, buf_size, get_max_record_size(ctx->max_seq_len), ctx->num_in_bufs);
+	}
+
+	window_size = LINE_INDEX_WINDOW;
+}
+
+FastxReader::FastxReader(FastxContext_t* ctx, const char* data, size_t size, size_t batch_size) : ctx(ctx), max_line_len(ctx->long_reads ? SIZE_MAX : ctx->max_seq_len), records(batch_size)
+{
+	if (ctx->format == FileFormat::FILE_FORMAT_UNKNOWN)
+		throw runtime_error("Unknown file format");
+
+	if (batch_size == 0)
+		throw invalid_argument("Batch size must be positive");
+
+	if (ctx->index)
+		throw invalid_argument("Offset index needs a sequential reader");
+
+	if (ctx->packed)
+	{
+		packed_pos = data;
+		packed_end = data + size;
+	}
+
+	block = data;
+	block_size = size;
+	eof = true;
+	window_size = LINE_INDEX_WINDOW;
+}
+
+template <LineBreak Break>
+static inline const char* next_line(const char* window, const uint32_t*& eols, const char*& line, size_t* len, size_t max_seq_len)
+{
+	const char* member = line;
+	const char* eol = window + *eols++;
+
+	*len = eol - line;
+
+	if constexpr (Break == LineBreak::LINE_BREAK_CRLF)
+	{
+		if (*len >= 2 && *(eol - 1) == CARRIAGE_RETN)
+			--*len;
+	}
+
+	if (*len >= max_seq_len)
+		throw out_of_range(format("Line length out of range: curr: {}, max: {}", *len, max_seq_len));
+
+	line = eol + 1;
+
+	return member;
+}
+
+template <FileFormat Format, LineBreak Break>
+size_t FastxReader::assemble_records(size_t num_records, size_t max_records)
+{
+	constexpr size_t member_count = RECORD_MEMBER_COUNTS[static_cast<uint8_t>(Format)];
+
+	const uint32_t* eol = eols.data() + eol_pos;
+	const char* line = block + block_pos;
+	size_t count = min((num_eols - eol_pos) / member_count, max_records - num_records);
+
+	for (size_t i = num_records; i < num_records + count; ++i)
+	{
+		FastxRecordView_t* record = &records[i];
+
+		record->seq_id = next_line<Break>(window, eol, line, &record->seq_id_len, max_line_len);
+		record->seq = next_line<Break>(window, eol, line, &record->seq_len, max_line_len);
+
+		if constexpr (Format == FileFormat::FILE_FORMAT_FASTQ)
+		{
+			record->desc = next_line<Break>(window, eol, line, &record->desc_len, max_line_len);
+			record->qual = next_line<Break>(window, eol, line, &record->qual_len, max_line_len);
+			record->read_count = 1;
+		}
+		else
+			record->read_count = get_read_count(ctx, record->seq_id, record->seq_id_len);
+
+		ctx->total_seq_count += record->seq_len;
+	}
+
+	eol_pos += count * member_count;
+	block_pos = line - block;
+
+	ctx->total_read_lines += count * member_count;
+	ctx->total_read_records += count;
+
+	return count;
+}
+
+FastxReader::AssembleFn FastxReader::select_assembler()
+{
+	// Called once the first window is indexed, so its first line is complete
+	if (ctx->line_break == LineBreak::LINE_BREAK_UNKNOWN)
+	{
+		const char* eol = window + eols[eol_pos];
+		const char* line = block + block_pos;
+
+		ctx->line_break = eol > line && *(eol - 1) == CARRIAGE_RETN ? LineBreak::LINE_BREAK_CRLF : LineBreak::LINE_BREAK_LF;
+	}
+
+	bool crlf = ctx->line_break == LineBreak::LINE_BREAK_CRLF;
+
+	switch (ctx->format)
+	{
+	case FileFormat::FILE_FORMAT_FASTA:
+		return crlf ? &FastxReader::assemble_records<FileFormat::FILE_FORMAT_FASTA, LineBreak::LINE_BREAK_CRLF> : &FastxReader::assemble_records<FileFormat::FILE_FORMAT_FASTA, LineBreak::LINE_BREAK_LF>;
+	case FileFormat::FILE_FORMAT_FASTQ:
+		return crlf ? &FastxReader::assemble_records<FileFormat::FILE_FORMAT_FASTQ, LineBreak::LINE_BREAK_CRLF> : &FastxReader::assemble_records<FileFormat::FILE_FORMAT_FASTQ, LineBreak::LINE_BREAK_LF>;
+	default:
+		throw runtime_error("Unknown file format");
+	}
+}
+
+bool FastxReader::index_window()
+{
+	size_t member_count = RECORD_MEMBER_COUNTS[static_cast<uint8_t>(ctx->format)];
+
+	while (block_pos < block_size)
+	{
+		size_t num_window_bytes = min(window_size, block_size - block_pos);
+
+		if (eols.size() < num_window_bytes)
+			eols.resize(num_window_bytes);
+
+		window = block + block_pos;
+		num_eols = index_lines(window, num_window_bytes, eols.data());
+		eol_pos = 0;
+
+		if (num_eols >= member_count)
+			return true;
+
+		// Either the tail of the block or a record longer than the window
+		if (num_window_bytes == block_size - block_pos)
+			break;
+
+		window_size *= 2;
+	}
+
+	num_eols = 0;
+	eol_pos = 0;
+
+	return false;
+}
+
+bool FastxReader::fill_block()
+{
+	if (eof)
+		return false;
+
+	ReadBlock_t* next_block = read_ahead->acquire();
+
+	if (!next_block)
+	{
+		eof = true;
+		return false;
+	}
+
+	size_t num_rem_bytes = block_size - block_pos;
+
+	// The new block starts with the partial record
+	block_offset += block_pos;
+
+	if (num_rem_bytes > read_ahead->get_prefix_size())
+	{
+		if (!ctx->long_reads)
+			throw out_of_range(format("Record length out of range: curr: {}, max: {}", num_rem_bytes, read_ahead->get_prefix_size()));
+
+		// The partial record keeps growing in the spill buffer until it is complete
+		if (block == spill.data())
+			spill.erase(spill.begin(), spill.begin() + block_pos);
+		else
+			spill.assign(block + block_pos, block + block_size);
+
+		spill.insert(spill.end(), read_ahead->get_data(next_block), read_ahead->get_data(next_block) + next_block->size);
+
+		if (curr_block)
+			read_ahead->release(curr_block);
+
+		read_ahead->release(next_block);
+
+		curr_block = nullptr;
+		block = spill.data();
+		block_size = spill.size();
+	}
+	else
+	{
+		// The partial record goes into the headroom right in front of the new data
+		char* data = read_ahead->get_data(next_block) - num_rem_bytes;
+
+		copy(block + block_pos, block + block_size, data);
+
+		// Views of the previous batch are released here
+		if (curr_block)
+			read_ahead->release(curr_block);
+
+		curr_block = next_block;
+		block = data;
+		block_size = num_rem_bytes + next_block->size;
+	}
+
+	block_pos = 0;
+	num_eols = 0;
+	eol_pos = 0;
+
+	return true;
+}
+
+void FastxReader::index_records(size_t num_records, size_t count)
+{
+	// Runs right after assembly, while the views still point into the block
+	size_t interval = ctx->index->get_interval();
+	size_t first = ctx->total_read_records - count;
+
+	for (size_t record = (first + interval - 1) / interval * interval; record < first + count; record += interval)
+		ctx->index->add(record, block_offset + (records[num_records + record - first].seq_id - block));
+}
+
+span<FastxRecordView_t> FastxReader::next_packed_batch()
+{
+	FASTX_TRACE_SCOPE("decode_fxb");
+	FASTX_PERF_SCOPE(PERF_STAGE_PARSE);
+
+	// Nothing to scan: each block lists its records
+	while (packed_record_pos == packed_records.size())
+	{
+		if (packed_pos == packed_end)
+			return span<FastxRecordView_t>();
+
+		packed_pos = decode_fxb_block(packed_pos, packed_end, packed_records, packed_seqs);
+		packed_record_pos = 0;
+	}
+
+	size_t count = min(records.size(), packed_records.size() - packed_record_pos);
+	span<FastxRecordView_t> batch(packed_records.data() + packed_record_pos, count);
+
+	for (const FastxRecordView_t& record : batch)
+		ctx->total_seq_count += record.seq_len;
+
+	ctx->total_read_lines += count * RECORD_MEMBER_COUNTS[static_cast<uint8_t>(FileFormat::FILE_FORMAT_FASTQ)];
+	ctx->total_read_records += count;
+	packed_record_pos += count;
+
+	return batch;
+}
+
+void FastxReader::skip_records(uint64_t num_records, const FxiIndex* index)
+{
+	if (num_records == 0)
+		return;
+
+	if (ctx->index)
+		throw invalid_argument("Offset index needs every record");
+
+	size_t total_read_lines = ctx->total_read_lines;
+	size_t total_read_records = ctx->total_read_records;
+	size_t total_seq_count = ctx->total_seq_count;
+	size_t batch_size = records.size();
+
+	if (index && ctx->map_base && block == ctx->map_base && !ctx->packed)
+	{
+		FxiEntry_t entry = index->seek(num_records);
+		const char signature = FILE_SIGNATURES[static_cast<uint8_t>(ctx->format)];
+
+		// Only an entry on a record start is trusted
+		if (entry.offset < block_size && block[entry.offset] == signature && (entry.offset == 0 || block[entry.offset - 1] == LINE_FEED))
+		{
+			block_pos = entry.offset;
+			num_records -= entry.record;
+		}
+	}
+
+	while (num_records > 0)
+	{
+		records.resize(min(num_records, static_cast<uint64_t>(batch_size)));
+
+		size_t count = next_batch().size();
+
+		if (count == 0)
+			break;
+
+		num_records -= count;
+	}
+
+	records.resize(batch_size);
+
+	ctx->total_read_lines = total_read_lines;
+	ctx->total_read_records = total_read_records;
+	ctx->total_seq_count = total_seq_count;
+}
+
+span<FastxRecordView_t> FastxReader::next_batch()
+{
+	if (ctx->packed)
+		return next_packed_batch();
+
+	FASTX_TRACE_SCOPE("parse");
+	FASTX_PERF_SCOPE(PERF_STAGE_PARSE);
+	size_t member_count = RECORD_MEMBER_COUNTS[static_cast<uint8_t>(ctx->format)];
+	size_t num_records = 0;
+	size_t num_packed = 0;
+
+	arena.reset();
+
+	while (num_records < records.size())
+	{
+		if (num_eols - eol_pos >= member_count)
+		{
+			if (!assemble)
+				assemble = select_assembler();
+
+			size_t count = (this->*assemble)(num_records, records.size());
+
+			if (ctx->index)
+				index_records(num_records, count);
+
+			num_records += count;
+			continue;
+		}
+
+		if (index_window())
+			continue;
+
+		// The current block is used up. Records of this batch move to the arena before it is released.
+		if (eof)
+			break;
+
+		for (; num_packed < num_records; ++num_packed)
+			arena.pack(&records[num_packed]);
+
+		if (!fill_block())
+			break;
+	}
+
+	return span<FastxRecordView_t>(records.data(), num_records);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+#include "fastx.hpp"
+#include "input-source.hpp"
+#include "perf-counters.hpp"
+#include "read-ahead.hpp"
+#include "record-arena.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+constexpr size_t DEFAULT_BATCH_SIZE = 500;
+
+// Pull-based record reader. Views returned by next_batch() stay valid until the next call.
+// Records of a batch that outlive their input block are packed into an arena.
+class FastxReader
+{
+public:
+	FastxReader(FastxContext_t* ctx, size_t buf_size, size_t batch_size = DEFAULT_BATCH_SIZE);
+
+	// Reads the records of an in-memory range that starts and ends on record boundaries
+	FastxReader(FastxContext_t* ctx, const char* data, size_t size, size_t batch_size = DEFAULT_BATCH_SIZE);
+
+	FastxReader(const FastxReader&) = delete;
+	FastxReader& operator=(const FastxReader&) = delete;
+
+	// Moves past the first num_records records. Call before the first batch. Mapped text input starts at the
+	// indexed record at or before num_records when index is given; the remainder is parsed and dropped.
+	// Skipped records are not counted in ctx.
+	void skip_records(uint64_t num_records, const FxiIndex* index = nullptr);
+
+	// Returns up to batch_size records, or an empty span at the end of input
+	span<FastxRecordView_t> next_batch();
+
+	// Calls visitor for each record of the next batch and returns the number of records visited
+	template <typename Visitor>
+	size_t next_batch(Visitor&& visitor)
+	{
+		span<FastxRecordView_t> batch = next_batch();
+		FASTX_TRACE_SCOPE("visit");
+		FASTX_PERF_SCOPE(PERF_STAGE_AGGREGATE);
+
+		for (FastxRecordView_t& record : batch)
+			visitor(record);
+
+		return batch.size();
+	}
+
+private:
+	typedef size_t(FastxReader::* AssembleFn)(size_t, size_t);
+
+	template <FileFormat Format, LineBreak Break>
+	size_t assemble_records(size_t num_records, size_t max_records);
+
+	AssembleFn select_assembler();
+	bool index_window();
+	bool fill_block();
+	span<FastxRecordView_t> next_packed_batch();
+	void index_records(size_t num_records, size_t count);
+
+	FastxContext_t* ctx;
+	AssembleFn assemble = nullptr;
+	size_t max_line_len;
+
+	unique_ptr<InputSource> file_source;
+	unique_ptr<ReadAhead> read_ahead;
+	ReadBlock_t* curr_block = nullptr;
+	vector<char> spill; // Holds a long record while it grows over several blocks
+	vector<FastxRecordView_t> records;
+	RecordArena arena;
+
+	// Current block: the whole mapping, or the carried tail plus the filled part of curr_block
+	const char* block = nullptr;
+	size_t block_size = 0;
+	size_t block_pos = 0;
+	size_t block_offset = 0; // Input offset of block
+	bool eof = false;
+
+	// Undecoded blocks and the records of the last decoded block of .fxb input
+	const char* packed_pos = nullptr;
+	const char* packed_end = nullptr;
+	vector<FastxRecordView_t> packed_records;
+	vector<char> packed_seqs;
+	size_t packed_record_pos = 0;
+
+	// Newline offsets of the indexed window, relative to window
+	vector<uint32_t> eols;
+	const char* window = nullptr;
+	size_t window_size = 0;
+	size_t num_eols = 0;
+	size_t eol_pos = 0;
+};
@@ -0,0 +1,123 @@
+#include <format>
+#include <stdexcept>
+#include "fastx-writer.hpp"
+#include "perf-counters.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+FastxWriter::FastxWriter(FILE* stream, size_t buf_size, size_t num_bufs)
+	: stream(stream), buf_size(buf_size), blocks(num_bufs)
+{
+	// One buffer is filled while the others are written
+	if (num_bufs < 2)
+		throw invalid_argument("Writer needs at least 2 buffers");
+
+	if (buf_size == 0)
+		throw invalid_argument("Output buffer size must be positive");
+
+	for (WriteBlock_t& block : blocks)
+	{
+		block.storage.resize(buf_size);
+		free_blocks.push_back(&block);
+	}
+
+	curr_block = free_blocks.front();
+	free_blocks.pop_front();
+
+	worker = thread(&FastxWriter::run, this);
+}
+
+FastxWriter::~FastxWriter()
+{
+	{
+		unique_lock<mutex> lock(mtx);
+
+		if (curr_block->size > 0)
+			filled_blocks.push_back(curr_block);
+
+		cv.notify_all();
+		cv.wait(lock, [this] { return filled_blocks.empty() && !busy; });
+		stop = true;
+	}
+
+	cv.notify_all();
+	worker.join();
+}
+
+void FastxWriter::run()
+{
+	FASTX_TRACE_THREAD("writer");
+
+	while (true)
+	{
+		WriteBlock_t* block = nullptr;
+
+		{
+			unique_lock<mutex> lock(mtx);
+			cv.wait(lock, [this] { return stop || !filled_blocks.empty(); });
+
+			if (filled_blocks.empty())
+				return;
+
+			block = filled_blocks.front();
+			filled_blocks.pop_front();
+			busy = true;
+		}
+
+		size_t num_written_bytes = block->size;
+
+		if (!error)
+		{
+			FASTX_TRACE_SCOPE("write");
+			FASTX_PERF_SCOPE(PERF_STAGE_OUTPUT);
+			num_written_bytes = fwrite(block->storage.data(), sizeof(char), block->size, stream);
+		}
+
+		{
+			lock_guard<mutex> lock(mtx);
+
+			// Remaining buffers are dropped after the first failure
+			if (num_written_bytes != block->size && !error)
+				error = make_exception_ptr(runtime_error(format("Failed to write output: {} of {} bytes written", num_written_bytes, block->size)));
+
+			block->size = 0;
+			free_blocks.push_back(block);
+			busy = false;
+		}
+
+		cv.notify_all();
+	}
+}
+
+void FastxWriter::submit()
+{
+	FASTX_TRACE_SCOPE("wait_output");
+	unique_lock<mutex> lock(mtx);
+
+	if (error)
+		rethrow_exception(error);
+
+	total_bytes_written += curr_block->size;
+	filled_blocks.push_back(curr_block);
+	cv.notify_all();
+
+	cv.wait(lock, [this] { return !free_blocks.empty(); });
+	curr_block = free_blocks.front();
+	free_blocks.pop_front();
+}
+
+void FastxWriter::flush()
+{
+	if (curr_block->size > 0)
+		submit();
+
+	unique_lock<mutex> lock(mtx);
+	cv.wait(lock, [this] { return filled_blocks.empty() && !busy; });
+
+	if (error)
+		rethrow_exception(error);
+
+	if (fflush(stream) != 0)
+		throw runtime_error("Failed to flush output");
+}
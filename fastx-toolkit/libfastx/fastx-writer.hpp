@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t NUM_OUT_BUFS = 3;
+
+typedef struct WriteBlock_s
+{
+	vector<char> storage;
+	size_t size = 0;
+} WriteBlock_t;
+
+// Buffered output. Full buffers are written by a background thread while the next one fills.
+// Call flush() before destruction to surface write errors.
+class FastxWriter
+{
+public:
+	FastxWriter(FILE* stream, size_t buf_size, size_t num_bufs = NUM_OUT_BUFS);
+	~FastxWriter();
+
+	FastxWriter(const FastxWriter&) = delete;
+	FastxWriter& operator=(const FastxWriter&) = delete;
+
+	void put(char c)
+	{
+		if (curr_block->size == buf_size)
+			submit();
+
+		curr_block->storage[curr_block->size++] = c;
+	}
+
+	void write(const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			if (curr_block->size == buf_size)
+				submit();
+
+			size_t copy_size = min(size, buf_size - curr_block->size);
+
+			copy(data, data + copy_size, curr_block->storage.data() + curr_block->size);
+			curr_block->size += copy_size;
+			data += copy_size;
+			size -= copy_size;
+		}
+	}
+
+	void write(string_view str) { write(str.data(), str.size()); }
+
+	void write_line_break(bool use_crlf)
+	{
+		if (use_crlf)
+			put('\r');
+
+		put('\n');
+	}
+
+	// Writes everything appended so far and waits until it reaches the stream
+	void flush();
+
+	size_t get_total_bytes_written() const { return total_bytes_written + curr_block->size; }
+
+private:
+	void submit();
+	void run();
+
+	FILE* stream;
+	size_t buf_size;
+	size_t total_bytes_written = 0;
+
+	vector<WriteBlock_t> blocks;
+	WriteBlock_t* curr_block = nullptr;
+	deque<WriteBlock_t*> free_blocks;
+	deque<WriteBlock_t*> filled_blocks;
+	bool busy = false;
+	bool stop = false;
+	exception_ptr error;
+
+	mutex mtx;
+	condition_variable cv;
+	thread worker;
+};
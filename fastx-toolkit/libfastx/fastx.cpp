@@ -5,6 +5,14 @@
 #include <iostream>
 #include <stdexcept>
 #include "fastx.hpp"
+#include "fxb.hpp"
+#include "fxi.hpp"
+#include "input-source.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 using namespace std;
 
@@ -28,18 +36,101 @@ void close_file(FILE* stream)
 		fclose(stream);
 }
 
-FileFormat get_file_format(FILE* stream)
+static int peek_char(FILE* stream)
 {
-	char sig = static_cast<char>(fgetc(stream));
-	fseek(stream, -1, SEEK_CUR);
+	int sig = fgetc(stream);
+
+	// ungetc also works on pipes, where seeking back fails
+	if (sig != EOF)
+		ungetc(sig, stream);
 
-	auto it = find(FILE_SIGNATURES.begin(), FILE_SIGNATURES.end(), sig);
+	return sig;
+}
+
+static FileFormat to_file_format(int sig)
+{
+	auto it = find(FILE_SIGNATURES.begin(), FILE_SIGNATURES.end(), static_cast<char>(sig));
 	char idx = it != FILE_SIGNATURES.end() ? static_cast<char>(distance(FILE_SIGNATURES.begin(), it)) : 0;
 
 	return static_cast<FileFormat>(idx);
 }
 
-uint32_t get_read_count(FastxContext_t* ctx, char* seq_id, size_t len)
+FileFormat get_file_format(FILE* stream)
+{
+	return to_file_format(peek_char(stream));
+}
+
+void open_input(FastxContext_t* ctx)
+{
+	if (peek_char(ctx->in_stream) == GZIP_MAGIC[0])
+	{
+#ifdef FASTX_WITH_ZLIB
+		GzipSource* source = new GzipSource(ctx->in_stream, ctx->num_inflate_threads);
+
+		ctx->source = source;
+		ctx->format = to_file_format(source->peek());
+		return;
+#else
+		throw runtime_error("gzip input requires zlib");
+#endif
+	}
+
+	if (peek_char(ctx->in_stream) == FXB_MAGIC[0])
+	{
+		// Packed input is only read through a mapping
+		ctx->io_mode = IoMode::IO_MODE_MMAP;
+
+		if (!map_file(ctx))
+			throw runtime_error("fxb input must be a regular file");
+
+		ctx->packed = true;
+		ctx->format = FileFormat::FILE_FORMAT_FASTQ;
+		ctx->line_break = get_fxb_line_break(ctx->map_base, ctx->map_size);
+		return;
+	}
+
+	ctx->format = get_file_format(ctx->in_stream);
+	map_file(ctx);
+}
+
+void close_input(FastxContext_t* ctx)
+{
+	if (ctx->source)
+	{
+		delete ctx->source;
+		ctx->source = nullptr;
+	}
+
+	ctx->index.reset();
+
+	unmap_file(ctx);
+	close_file(ctx->in_stream);
+}
+
+FastxContext_t copy_context_settings(const FastxContext_t& ctx)
+{
+	FastxContext_t copy;
+
+	memcpy(copy.in_name, ctx.in_name, sizeof(copy.in_name));
+	memcpy(copy.out_name, ctx.out_name, sizeof(copy.out_name));
+	copy.in_stream = ctx.in_stream;
+	copy.out_stream = ctx.out_stream;
+	copy.format = ctx.format;
+	copy.line_break = ctx.line_break;
+	copy.io_mode = ctx.io_mode;
+	copy.map_base = ctx.map_base;
+	copy.map_size = ctx.map_size;
+	copy.packed = ctx.packed;
+	copy.num_in_bufs = ctx.num_in_bufs;
+	copy.source = ctx.source;
+	copy.num_inflate_threads = ctx.num_inflate_threads;
+	copy.max_seq_len = ctx.max_seq_len;
+	copy.long_reads = ctx.long_reads;
+
+	return copy;
+}
+
+uint32_t get_read_count(FastxContext_t* ctx, const char* seq_id, size_t len)
 {
 	uint32_t result = 1;
 
@@ -48,7 +139,7 @@ uint32_t get_read_count(FastxContext_t* ctx, char* seq_id, size_t len)
 
 	if (ctx->format == FileFormat::FILE_FORMAT_FASTA)
 	{
-		char* dash = reinterpret_cast<char*>(memchr(seq_id, '-', len));
+		const char* dash = reinterpret_cast<const char*>(memchr(seq_id, '-', len));
 
 		if (dash)
 			result = atoi(dash + 1);
@@ -65,70 +156,72 @@ size_t fwrite_with_line(const void* buf, size_t elem_size, size_t elem_count, FI
 	return use_crlf ? num_written_bytes + 2 : num_written_bytes + 1;
 }
 
-DispatchResult_t dispatch_records(char* buf, size_t buf_size, size_t offset, FastxContext_t* ctx, FastxRecord_t* records, size_t* record_idx, function<void(FastxRecord_t*, size_t)>& callback)
+size_t get_max_record_size(size_t max_seq_len)
 {
-	size_t member_count = RECORD_MEMBER_COUNTS[static_cast<int8_t>(ctx->format)];
-	size_t line_offset = 0;
+	// Every line may carry up to max_seq_len - 1 bytes plus CRLF
+	return (max_seq_len + 1) * RECORD_MEMBER_COUNTS[static_cast<uint8_t>(FileFormat::FILE_FORMAT_FASTQ)];
+}
 
-	size_t num_read_bytes = fread(buf + offset, sizeof(char), buf_size - offset, ctx->in_stream) + offset;
-	size_t num_proc_bytes = 0;
-	size_t num_rem_bytes = 0;
-	size_t num_proc_records = 0;
+static void copy_member(const char* src, size_t src_len, char* dst, size_t* dst_len, size_t max_seq_len)
+{
+	if (!dst || !src)
+		return;
 
-	char* prev_eol = buf;
-	char* next_eol = nullptr;
+	if (src_len >= max_seq_len)
+		throw out_of_range(format("Line length out of range: curr: {}, max: {}", src_len, max_seq_len));
 
-	if (num_read_bytes > 0)
-	{
-		while (prev_eol < buf + num_read_bytes)
-		{
-			char* next_member_buf = nullptr;
-			size_t adv_offset = 0;
-			size_t len = 0;
-
-			next_eol = reinterpret_cast<char*>(memchr(prev_eol, LINE_FEED, num_read_bytes - num_proc_bytes));
-
-			if (!next_eol)
-				break;
-
-			if (prev_eol + 2 <= next_eol && *(next_eol - 1) == CARRIAGE_RETN)
-				adv_offset = 1;
-
-			line_offset = ctx->total_read_lines % member_count;
-			next_member_buf = reinterpret_cast<char**>(&records[*record_idx])[line_offset];
-
-			if (next_member_buf)
-			{
-				len = next_eol - prev_eol - adv_offset;
-
-				if (len >= ctx->max_seq_len)
-					throw out_of_range(format("Line length out of range: curr: {}, max: {}", len, ctx->max_seq_len));
-
-				copy(prev_eol, prev_eol + len, next_member_buf);
-				next_member_buf[len] = '\0';
-				reinterpret_cast<size_t*>(reinterpret_cast<char*>(&records[*record_idx]) + sizeof(char*) * member_count)[line_offset] = len;
-			}
-
-			if (line_offset == member_count - 1)
-			{
-				records[*record_idx].read_count = get_read_count(ctx, records[*record_idx].seq_id, records[*record_idx].seq_id_len);
-				ctx->total_seq_count += records[*record_idx].seq_len;
-				callback(&records[*record_idx], num_proc_records);
-				++num_proc_records;
-				++ctx->total_read_records;
-			}
-
-			num_proc_bytes += next_eol - prev_eol + 1;
-			prev_eol = next_eol + 1;
-			++ctx->total_read_lines;
-		}
-	}
+	copy(src, src + src_len, dst);
+	dst[src_len] = '\0';
+	*dst_len = src_len;
+}
 
-	if ((num_rem_bytes = num_read_bytes - num_proc_bytes) > 0)
-	{
-		copy(buf + num_proc_bytes, buf + num_read_bytes, buf);
-		buf[num_rem_bytes + 1] = '\0';
-	}
+void copy_record(const FastxRecordView_t* view, FastxRecord_t* record, size_t max_seq_len)
+{
+	copy_member(view->seq_id, view->seq_id_len, record->seq_id, &record->seq_id_len, max_seq_len);
+	copy_member(view->seq, view->seq_len, record->seq, &record->seq_len, max_seq_len);
+	copy_member(view->desc, view->desc_len, record->desc, &record->desc_len, max_seq_len);
+	copy_member(view->qual, view->qual_len, record->qual, &record->qual_len, max_seq_len);
+
+	record->read_count = view->read_count;
+}
+
+bool map_file(FastxContext_t* ctx)
+{
+#ifndef _WIN32
+	struct stat st;
+	int fd = fileno(ctx->in_stream);
+
+	if (ctx->io_mode != IoMode::IO_MODE_MMAP || fd < 0 || fstat(fd, &st) != 0)
+		return false;
+
+	// Pipes, terminals and empty files keep using the buffered path
+	if (!S_ISREG(st.st_mode) || st.st_size <= 0)
+		return false;
+
+	void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (addr == MAP_FAILED)
+		return false;
+
+	madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+	madvise(addr, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+
+	ctx->map_base = reinterpret_cast<const char*>(addr);
+	ctx->map_size = static_cast<size_t>(st.st_size);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void unmap_file(FastxContext_t* ctx)
+{
+#ifndef _WIN32
+	if (ctx->map_base)
+		munmap(const_cast<char*>(ctx->map_base), ctx->map_size);
+#endif
 
-	return { num_read_bytes, num_proc_bytes, num_rem_bytes, num_proc_records };
+	ctx->map_base = nullptr;
+	ctx->map_size = 0;
 }
\ No newline at end of file
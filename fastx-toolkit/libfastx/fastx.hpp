@@ -1,15 +1,27 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdio>
 #include <functional>
+#include <memory>
 #include <vector>
 
 using namespace std;
 
+class InputSource;
+class FxiIndex;
+
+// Lets FastxContext_t own an index where FxiIndex is incomplete
+struct FxiIndexDeleter
+{
+	void operator()(FxiIndex* index) const;
+};
+
 constexpr char LINE_FEED = '\n';
 constexpr char CARRIAGE_RETN = '\r';
 constexpr size_t MAX_PATH = 255;
 constexpr size_t MAX_SEQUENCE_LENGTH = 25000;
+constexpr size_t NUM_IN_BUFS = 3;
 
 constexpr int BASE_QUALITY_OFFSET = 33;
 constexpr int MIN_QUALITY = -15;
@@ -23,6 +35,19 @@ enum class FileFormat : uint8_t
 	_FILE_FORMAT_COUNT_,
 };
 
+enum class LineBreak : uint8_t
+{
+	LINE_BREAK_UNKNOWN,
+	LINE_BREAK_LF,
+	LINE_BREAK_CRLF,
+};
+
+enum class IoMode : uint8_t
+{
+	IO_MODE_READ,
+	IO_MODE_MMAP,
+};
+
 typedef struct FastxContext_s
 {
 	char in_name[MAX_PATH] = { 0 };
@@ -32,8 +57,25 @@ typedef struct FastxContext_s
 	FILE* out_stream = stdout;
 
 	FileFormat format = FileFormat::FILE_FORMAT_UNKNOWN;
+	LineBreak line_break = LineBreak::LINE_BREAK_UNKNOWN; // Detected from the first line
+	IoMode io_mode = IoMode::IO_MODE_MMAP;
+
+	// Set by map_file() when the input is a mapped regular file
+	const char* map_base = nullptr;
+	size_t map_size = 0;
+	bool packed = false; // Set by open_input() when the mapped file is .fxb
+
+	size_t num_in_bufs = NUM_IN_BUFS; // Blocks in the read-ahead ring
+
+	// Set by open_input() for compressed input
+	InputSource* source = nullptr;
+	size_t num_inflate_threads = 0; // 0 uses every hardware thread
+
+	// Set by the caller to build a record offset index while reading text input. Freed by close_input().
+	unique_ptr<FxiIndex, FxiIndexDeleter> index;
 
 	size_t max_seq_len = MAX_SEQUENCE_LENGTH;
+	bool long_reads = false; // Lifts max_seq_len and lets a record span any number of input blocks
 	size_t total_read_lines = 0;
 	size_t total_read_records = 0;
 	size_t total_seq_count = 0;
@@ -53,23 +95,39 @@ typedef struct FastxRecord_s
 	size_t read_count;
 } FastxRecord_t;
 
-typedef struct DispatchResult_s
+// Non-owning view into the input buffer. Valid until the reader returns its next batch.
+typedef struct FastxRecordView_s
 {
-	size_t num_read_bytes = 0;
-	size_t num_proc_bytes = 0;
-	size_t num_rem_bytes = 0;
-	size_t num_proc_records = 0;
-} DispatchResult_t;
+	const char* seq_id;
+	const char* seq;
+	const char* desc;
+	const char* qual;
+
+	size_t seq_id_len;
+	size_t seq_len;
+	size_t desc_len;
+	size_t qual_len;
+	size_t read_count;
+} FastxRecordView_t;
 
-static uint8_t RECORD_MEMBER_COUNTS[static_cast<uint8_t>(FileFormat::_FILE_FORMAT_COUNT_)] = { 0, 2, 4 };
+constexpr uint8_t RECORD_MEMBER_COUNTS[static_cast<uint8_t>(FileFormat::_FILE_FORMAT_COUNT_)] = { 0, 2, 4 };
 
 const vector<char> FILE_SIGNATURES = { '\0', '>', '@' };
 
 void open_file(const char* file_name, const char* mode, FILE** stream);
 void close_file(FILE* stream);
+bool map_file(FastxContext_t* ctx);
+void unmap_file(FastxContext_t* ctx);
+void open_input(FastxContext_t* ctx);
+void close_input(FastxContext_t* ctx);
+
+// Context of a reader over part of the input of ctx: the same settings and detected format, zero counters and
+// no index
+FastxContext_t copy_context_settings(const FastxContext_t& ctx);
 
 FileFormat get_file_format(FILE* stream);
-uint32_t get_read_count(FastxContext_t* ctx, char* seq_id, size_t len);
+uint32_t get_read_count(FastxContext_t* ctx, const char* seq_id, size_t len);
+size_t get_max_record_size(size_t max_seq_len);
+void copy_record(const FastxRecordView_t* view, FastxRecord_t* record, size_t max_seq_len);
 
-size_t fwrite_with_line(const void* buf, size_t elem_size, size_t elem_count, FILE* stream, bool use_crlf = false);
-DispatchResult_t dispatch_records(char* buf, size_t buf_size, size_t offset, FastxContext_t* ctx, FastxRecord_t* records, size_t* record_idx, function<void(FastxRecord_t*, size_t)>& callback);
\ No newline at end of file
+size_t fwrite_with_line(const void* buf, size_t elem_size, size_t elem_count, FILE* stream, bool use_crlf = false);
\ No newline at end of file
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include "fxb.hpp"
+
+using namespace std;
+
+static constexpr uint8_t NO_CODE = 0xFF;
+
+static constexpr array<uint8_t, 256> make_nuc_codes()
+{
+	array<uint8_t, 256> codes = {};
+
+	for (uint8_t& code : codes)
+		code = NO_CODE;
+
+	codes['A'] = 0;
+	codes['C'] = 1;
+	codes['G'] = 2;
+	codes['T'] = 3;
+
+	return codes;
+}
+
+// Four nucleotides per packed byte, as they appear in memory
+static constexpr array<uint32_t, 256> make_nuc_quads()
+{
+	constexpr char NUCS[] = { 'A', 'C', 'G', 'T' };
+	array<uint32_t, 256> quads = {};
+
+	for (size_t i = 0; i < quads.size(); ++i)
+	{
+		for (size_t j = 0; j < 4; ++j)
+			quads[i] |= static_cast<uint32_t>(static_cast<uint8_t>(NUCS[(i >> (j * 2)) & 3])) << (j * 8);
+	}
+
+	return quads;
+}
+
+static constexpr array<uint8_t, 256> NUC_CODES = make_nuc_codes();
+static constexpr array<uint32_t, 256> NUC_QUADS = make_nuc_quads();
+
+static inline void append_bytes(vector<char>& buf, const void* data, size_t size)
+{
+	const char* bytes = reinterpret_cast<const char*>(data);
+	buf.insert(buf.end(), bytes, bytes + size);
+}
+
+template <typename T>
+static inline T read_value(const char*& pos, const char* end)
+{
+	T value;
+
+	if (static_cast<size_t>(end - pos) < sizeof(T))
+		throw runtime_error("Corrupt fxb block");
+
+	memcpy(&value, pos, sizeof(T));
+	pos += sizeof(T);
+
+	return value;
+}
+
+static inline const char* read_bytes(const char*& pos, const char* end, size_t size)
+{
+	const char* bytes = pos;
+
+	if (static_cast<size_t>(end - pos) < size)
+		throw runtime_error("Corrupt fxb block");
+
+	pos += size;
+
+	return bytes;
+}
+
+FxbEncoder::FxbEncoder(FastxWriter* writer, LineBreak line_break, size_t block_records) : writer(writer), block_records(block_records)
+{
+	FxbHeader_t header = {};
+
+	if (block_records == 0)
+		throw invalid_argument("fxb block must hold at least one record");
+
+	copy(begin(FXB_MAGIC), end(FXB_MAGIC), header.magic);
+	header.flags = line_break == LineBreak::LINE_BREAK_CRLF ? FXB_FLAG_CRLF : 0;
+
+	writer->write(reinterpret_cast<const char*>(&header), sizeof(header));
+	offset = sizeof(header);
+}
+
+void FxbEncoder::encode(const FastxRecordView_t& record)
+{
+	FxbRecordHeader_t header = {};
+
+	if (!record.qual)
+		throw runtime_error("fxb only stores FASTQ records");
+
+	if (max({ record.seq_id_len, record.desc_len, record.seq_len, record.qual_len }) > UINT32_MAX)
+		throw out_of_range(format("Record too long for fxb: {}", record.seq_len));
+
+	runs.clear();
+
+	for (size_t i = 0; i < record.seq_len; ++i)
+	{
+		if (NUC_CODES[static_cast<uint8_t>(record.seq[i])] != NO_CODE)
+			continue;
+
+		if (!runs.empty() && runs.back().pos + runs.back().len == i && runs.back().nuc == record.seq[i])
+			runs.back().len++;
+		else
+			runs.push_back({ static_cast<uint32_t>(i), 1, record.seq[i] });
+	}
+
+	header.seq_id_len = static_cast<uint32_t>(record.seq_id_len);
+	header.desc_len = static_cast<uint32_t>(record.desc_len);
+	header.seq_len = static_cast<uint32_t>(record.seq_len);
+	header.qual_len = static_cast<uint32_t>(record.qual_len);
+	header.num_runs = static_cast<uint32_t>(runs.size());
+
+	append_bytes(block, &header, sizeof(header));
+	append_bytes(block, record.seq_id, record.seq_id_len);
+	append_bytes(block, record.desc, record.desc_len);
+
+	// Bytes covered by a run pack as 'A' and are restored from the run
+	size_t packed_pos = block.size();
+	block.resize(packed_pos + (record.seq_len + 3) / 4, 0);
+
+	for (size_t i = 0; i < record.seq_len; ++i)
+	{
+		uint8_t code = NUC_CODES[static_cast<uint8_t>(record.seq[i])];
+
+		if (code != NO_CODE)
+			block[packed_pos + i / 4] |= static_cast<char>(code << ((i % 4) * 2));
+	}
+
+	for (const FxbRun_t& run : runs)
+	{
+		append_bytes(block, &run.pos, sizeof(run.pos));
+		append_bytes(block, &run.len, sizeof(run.len));
+		append_bytes(block, &run.nuc, sizeof(run.nuc));
+	}
+
+	append_bytes(block, record.qual, record.qual_len);
+
+	block_seq_size += record.seq_len;
+
+	if (++num_block_records == block_records)
+		flush_block();
+}
+
+void FxbEncoder::flush_block()
+{
+	FxbBlockHeader_t header = {};
+
+	header.num_records = num_block_records;
+	header.payload_size = block.size();
+	header.seq_size = block_seq_size;
+
+	index.push_back({ offset, num_records });
+
+	writer->write(reinterpret_cast<const char*>(&header), sizeof(header));
+	writer->write(block.data(), block.size());
+
+	offset += sizeof(header) + block.size();
+	num_records += num_block_records;
+
+	block.clear();
+	num_block_records = 0;
+	block_seq_size = 0;
+}
+
+void FxbEncoder::finish()
+{
+	FxbFooter_t footer = {};
+
+	if (num_block_records > 0)
+		flush_block();
+
+	footer.index_offset = offset;
+	footer.num_blocks = index.size();
+	footer.num_records = num_records;
+	copy(begin(FXB_MAGIC), end(FXB_MAGIC), footer.magic);
+
+	writer->write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(FxbBlockEntry_t));
+	writer->write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+}
+
+bool is_fxb(const char* data, size_t size)
+{
+	return size >= sizeof(FxbHeader_t) && equal(begin(FXB_MAGIC), end(FXB_MAGIC), data);
+}
+
+FxbFooter_t read_fxb_footer(const char* data, size_t size)
+{
+	FxbFooter_t footer;
+
+	if (!is_fxb(data, size) || size < sizeof(FxbHeader_t) + sizeof(FxbFooter_t))
+		throw runtime_error("Invalid fxb file");
+
+	memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+
+	if (!equal(begin(FXB_MAGIC), end(FXB_MAGIC), footer.magic) ||
+		footer.index_offset < sizeof(FxbHeader_t) ||
+		footer.num_blocks > (size - sizeof(footer)) / sizeof(FxbBlockEntry_t) ||
+		footer.index_offset + footer.num_blocks * sizeof(FxbBlockEntry_t) != size - sizeof(footer))
+		throw runtime_error("Truncated or corrupt fxb file");
+
+	return footer;
+}
+
+LineBreak get_fxb_line_break(const char* data, size_t size)
+{
+	FxbHeader_t header;
+
+	read_fxb_footer(data, size);
+	memcpy(&header, data, sizeof(header));
+
+	return header.flags & FXB_FLAG_CRLF ? LineBreak::LINE_BREAK_CRLF : LineBreak::LINE_BREAK_LF;
+}
+
+ByteRange_t get_fxb_blocks(const char* data, size_t size)
+{
+	return { sizeof(FxbHeader_t), read_fxb_footer(data, size).index_offset };
+}
+
+vector<ByteRange_t> split_fxb_blocks(const char* data, size_t size, size_t num_ranges)
+{
+	FxbFooter_t footer = read_fxb_footer(data, size);
+	ByteRange_t blocks = get_fxb_blocks(data, size);
+	vector<uint64_t> offsets(footer.num_blocks);
+	vector<ByteRange_t> ranges;
+	size_t begin = blocks.begin;
+
+	for (size_t i = 0; i < offsets.size(); ++i)
+	{
+		FxbBlockEntry_t entry;
+
+		memcpy(&entry, data + footer.index_offset + i * sizeof(entry), sizeof(entry));
+		offsets[i] = entry.offset;
+	}
+
+	num_ranges = max(num_ranges, static_cast<size_t>(1));
+
+	for (size_t i = 1; i <= num_ranges && begin < blocks.end; ++i)
+	{
+		size_t target = blocks.begin + (blocks.end - blocks.begin) / num_ranges * i;
+		auto it = lower_bound(offsets.begin(), offsets.end(), max(begin, target));
+		size_t end = i == num_ranges || it == offsets.end() ? blocks.end : *it;
+
+		if (end > begin)
+			ranges.push_back({ begin, end });
+
+		begin = end;
+	}
+
+	return ranges;
+}
+
+const char* decode_fxb_block(const char* pos, const char* end, vector<FastxRecordView_t>& records, vector<char>& seq_buf)
+{
+	FxbBlockHeader_t header = read_value<FxbBlockHeader_t>(pos, end);
+	char* seq = nullptr;
+
+	if (static_cast<size_t>(end - pos) < header.payload_size)
+		throw runtime_error("Corrupt fxb block");
+
+	const char* block_end = pos + header.payload_size;
+
+	records.resize(header.num_records);
+	seq_buf.resize(header.seq_size);
+	seq = seq_buf.data();
+
+	for (FastxRecordView_t& record : records)
+	{
+		FxbRecordHeader_t rec_header = read_value<FxbRecordHeader_t>(pos, block_end);
+
+		if (static_cast<size_t>(seq_buf.data() + seq_buf.size() - seq) < rec_header.seq_len)
+			throw runtime_error("Corrupt fxb block");
+
+		record.seq_id = read_bytes(pos, block_end, rec_header.seq_id_len);
+		record.seq_id_len = rec_header.seq_id_len;
+		record.desc = read_bytes(pos, block_end, rec_header.desc_len);
+		record.desc_len = rec_header.desc_len;
+
+		const uint8_t* packed = reinterpret_cast<const uint8_t*>(read_bytes(pos, block_end, (rec_header.seq_len + 3) / 4));
+		size_t num_full_bytes = rec_header.seq_len / 4;
+
+		for (size_t i = 0; i < num_full_bytes; ++i)
+			memcpy(seq + i * 4, &NUC_QUADS[packed[i]], 4);
+
+		if (rec_header.seq_len % 4)
+			memcpy(seq + num_full_bytes * 4, &NUC_QUADS[packed[num_full_bytes]], rec_header.seq_len % 4);
+
+		for (uint32_t i = 0; i < rec_header.num_runs; ++i)
+		{
+			uint32_t run_pos = read_value<uint32_t>(pos, block_end);
+			uint32_t run_len = read_value<uint32_t>(pos, block_end);
+			char nuc = read_value<char>(pos, block_end);
+
+			if (static_cast<uint64_t>(run_pos) + run_len > rec_header.seq_len)
+				throw runtime_error("Corrupt fxb block");
+
+			fill(seq + run_pos, seq + run_pos + run_len, nuc);
+		}
+
+		record.seq = seq;
+		record.seq_len = rec_header.seq_len;
+		record.qual = read_bytes(pos, block_end, rec_header.qual_len);
+		record.qual_len = rec_header.qual_len;
+		record.read_count = 1;
+
+		seq += rec_header.seq_len;
+	}
+
+	if (pos != block_end)
+		throw runtime_error("Corrupt fxb block");
+
+	return block_end;
+}
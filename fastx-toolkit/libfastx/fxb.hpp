@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "fastx.hpp"
+#include "fastx-writer.hpp"
+#include "range-splitter.hpp"
+
+using namespace std;
+
+// .fxb is a packed FASTQ cache in host byte order:
+//   header | block* | block index | footer
+// Each block holds up to FXB_BLOCK_RECORDS records. A record stores its id and '+' lines verbatim,
+// the sequence as 2-bit ACGT codes plus runs of any other byte, and the quality line verbatim.
+constexpr char FXB_MAGIC[4] = { 'F', 'X', 'B', '1' };
+constexpr size_t FXB_BLOCK_RECORDS = 8192;
+constexpr uint32_t FXB_FLAG_CRLF = 1;
+
+typedef struct FxbHeader_s
+{
+	char magic[4];
+	uint32_t flags;
+} FxbHeader_t;
+
+typedef struct FxbBlockHeader_s
+{
+	uint32_t num_records;
+	uint32_t reserved;
+	uint64_t payload_size;
+	uint64_t seq_size; // Sum of the unpacked sequence lengths
+} FxbBlockHeader_t;
+
+typedef struct FxbRecordHeader_s
+{
+	uint32_t seq_id_len;
+	uint32_t desc_len;
+	uint32_t seq_len;
+	uint32_t qual_len;
+	uint32_t num_runs;
+} FxbRecordHeader_t;
+
+// A run of bytes that are not upper-case ACGT, such as N
+typedef struct FxbRun_s
+{
+	uint32_t pos;
+	uint32_t len;
+	char nuc;
+} FxbRun_t;
+
+typedef struct FxbBlockEntry_s
+{
+	uint64_t offset; // From the start of the file
+	uint64_t first_record;
+} FxbBlockEntry_t;
+
+typedef struct FxbFooter_s
+{
+	uint64_t index_offset;
+	uint64_t num_blocks;
+	uint64_t num_records;
+	char magic[4];
+	uint32_t reserved;
+} FxbFooter_t;
+
+// Encodes FASTQ records into .fxb through a FastxWriter
+class FxbEncoder
+{
+public:
+	FxbEncoder(FastxWriter* writer, LineBreak line_break, size_t block_records = FXB_BLOCK_RECORDS);
+
+	FxbEncoder(const FxbEncoder&) = delete;
+	FxbEncoder& operator=(const FxbEncoder&) = delete;
+
+	void encode(const FastxRecordView_t& record);
+
+	// Writes the last block, the block index and the footer
+	void finish();
+
+private:
+	void flush_block();
+
+	FastxWriter* writer;
+	size_t block_records;
+
+	vector<char> block;
+	vector<FxbRun_t> runs;
+	vector<FxbBlockEntry_t> index;
+	uint32_t num_block_records = 0;
+	uint64_t block_seq_size = 0;
+	uint64_t num_records = 0;
+	uint64_t offset = 0;
+};
+
+bool is_fxb(const char* data, size_t size);
+
+// Validates the header and footer and returns the footer
+FxbFooter_t read_fxb_footer(const char* data, size_t size);
+
+LineBreak get_fxb_line_break(const char* data, size_t size);
+
+// Returns the byte range holding all blocks of a mapped .fxb file
+ByteRange_t get_fxb_blocks(const char* data, size_t size);
+
+// Cuts the blocks into at most num_ranges ranges of whole blocks
+vector<ByteRange_t> split_fxb_blocks(const char* data, size_t size, size_t num_ranges);
+
+// Decodes the block at pos into records. Sequences are unpacked into seq_buf; ids and qualities point into the block.
+// Returns the position of the next block.
+const char* decode_fxb_block(const char* pos, const char* end, vector<FastxRecordView_t>& records, vector<char>& seq_buf);
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+#include "fxi.hpp"
+
+using namespace std;
+
+void FxiIndexDeleter::operator()(FxiIndex* index) const
+{
+	delete index;
+}
+
+FxiIndex::FxiIndex(size_t interval) : interval(interval)
+{
+	if (interval == 0)
+		throw invalid_argument("Index interval must be positive");
+}
+
+void FxiIndex::finish(uint64_t num_records, const FxiStamp_t& stamp)
+{
+	this->num_records = num_records;
+	this->stamp = stamp;
+}
+
+void FxiIndex::save(const string& path) const
+{
+	FILE* stream = nullptr;
+	FxiHeader_t header = {};
+
+	copy(begin(FXI_MAGIC), end(FXI_MAGIC), header.magic);
+	header.interval = interval;
+	header.num_records = num_records;
+	header.file_size = stamp.file_size;
+	header.mtime = stamp.mtime;
+	header.fingerprint = stamp.fingerprint;
+	header.num_entries = entries.size();
+
+	open_file(path.c_str(), "wb", &stream);
+
+	bool result = fwrite(&header, sizeof(header), 1, stream) == 1;
+	result &= fwrite(entries.data(), sizeof(FxiEntry_t), entries.size(), stream) == entries.size();
+	result &= fclose(stream) == 0;
+
+	if (!result)
+		throw runtime_error(format("Failed to write index: {}", path));
+}
+
+bool FxiIndex::load(const string& path)
+{
+	FILE* stream = fopen(path.c_str(), "rb");
+	FxiHeader_t header;
+
+	if (!stream)
+		return false;
+
+	bool result = fread(&header, sizeof(header), 1, stream) == 1;
+
+	// An index of an older format is rebuilt by the next --fxi pass
+	if (result && equal(begin(FXI_MAGIC), prev(end(FXI_MAGIC)), header.magic) && header.magic[3] < FXI_MAGIC[3])
+	{
+		fclose(stream);
+		return false;
+	}
+
+	result = result && equal(begin(FXI_MAGIC), end(FXI_MAGIC), header.magic) && header.interval > 0;
+
+	// The entry count of a damaged index must not size the allocation
+	result = result && header.num_entries == (filesystem::file_size(path) - sizeof(header)) / sizeof(FxiEntry_t);
+
+	if (result)
+	{
+		entries.resize(header.num_entries);
+		result = fread(entries.data(), sizeof(FxiEntry_t), entries.size(), stream) == entries.size();
+	}
+
+	fclose(stream);
+
+	if (!result)
+		throw runtime_error(format("Invalid index: {}", path));
+
+	interval = header.interval;
+	num_records = header.num_records;
+	stamp = { header.file_size, header.mtime, header.fingerprint };
+
+	return true;
+}
+
+FxiEntry_t FxiIndex::seek(uint64_t record) const
+{
+	auto it = upper_bound(entries.begin(), entries.end(), record, [](uint64_t record, const FxiEntry_t& entry) { return record < entry.record; });
+
+	if (it == entries.begin())
+		return { 0, 0 };
+
+	return *prev(it);
+}
+
+vector<ByteRange_t> FxiIndex::split(size_t num_ranges) const
+{
+	vector<ByteRange_t> ranges;
+	size_t begin = 0;
+
+	num_ranges = max(num_ranges, static_cast<size_t>(1));
+
+	// Equal record counts, rounded to indexed records
+	for (size_t i = 1; i <= num_ranges && begin < stamp.file_size; ++i)
+	{
+		size_t end = i == num_ranges ? stamp.file_size : seek(num_records / num_ranges * i).offset;
+
+		if (end > begin)
+			ranges.push_back({ begin, end });
+
+		begin = max(begin, end);
+	}
+
+	return ranges;
+}
+
+string get_index_path(const char* in_name)
+{
+	return string(in_name) + ".fxi";
+}
+
+static void hash_bytes(uint64_t* hash, const char* data, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+		*hash = (*hash ^ static_cast<uint8_t>(data[i])) * 0x100000001B3ull;
+}
+
+FxiStamp_t get_file_stamp(const char* path)
+{
+	FxiStamp_t stamp;
+	FILE* stream = nullptr;
+	char buf[FXI_FINGERPRINT_BYTES];
+
+	stamp.file_size = filesystem::file_size(path);
+	stamp.mtime = chrono::duration_cast<chrono::nanoseconds>(filesystem::last_write_time(path).time_since_epoch()).count();
+	stamp.fingerprint = 0xCBF29CE484222325ull;
+
+	open_file(path, "rb", &stream);
+
+	// The ends overlap in a small file, which does not matter for a fingerprint
+	size_t head_size = fread(buf, 1, sizeof(buf), stream);
+	hash_bytes(&stamp.fingerprint, buf, head_size);
+
+	if (stamp.file_size > sizeof(buf) && fseek(stream, -static_cast<long>(sizeof(buf)), SEEK_END) == 0)
+		hash_bytes(&stamp.fingerprint, buf, fread(buf, 1, sizeof(buf), stream));
+
+	fclose(stream);
+
+	return stamp;
+}
+
+bool load_index(FxiIndex* index, const char* in_name)
+{
+	return strlen(in_name) > 0 && index->load(get_index_path(in_name)) && index->matches(get_file_stamp(in_name));
+}
+
+void write_index(FastxContext_t* ctx)
+{
+	if (!ctx->index)
+		return;
+
+	if (strlen(ctx->in_name) == 0)
+		throw runtime_error("Index needs an input file name");
+
+	ctx->index->finish(ctx->total_read_records, get_file_stamp(ctx->in_name));
+	ctx->index->save(get_index_path(ctx->in_name));
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "fastx.hpp"
+#include "range-splitter.hpp"
+
+using namespace std;
+
+// .fxi is a sparse sidecar index of a text FASTX file: the byte offset of every interval-th record
+constexpr char FXI_MAGIC[4] = { 'F', 'X', 'I', '2' };
+constexpr size_t FXI_INTERVAL = 65536;
+constexpr size_t FXI_FINGERPRINT_BYTES = 4096; // Hashed at each end of the file
+
+// Identifies one version of the indexed file. An index is only used while the file still has the same stamp.
+typedef struct FxiStamp_s
+{
+	uint64_t file_size = 0;
+	int64_t mtime = 0; // Nanoseconds since the file clock epoch
+	uint64_t fingerprint = 0; // FNV-1a of the first and last FXI_FINGERPRINT_BYTES, for copies that keep the mtime
+
+	bool operator==(const FxiStamp_s&) const = default;
+} FxiStamp_t;
+
+typedef struct FxiHeader_s
+{
+	char magic[4];
+	uint32_t reserved;
+	uint64_t interval;
+	uint64_t num_records;
+	uint64_t file_size; // file_size, mtime and fingerprint reject an index of another file or version
+	int64_t mtime;
+	uint64_t fingerprint;
+	uint64_t num_entries;
+} FxiHeader_t;
+
+typedef struct FxiEntry_s
+{
+	uint64_t record;
+	uint64_t offset;
+} FxiEntry_t;
+
+class FxiIndex
+{
+public:
+	explicit FxiIndex(size_t interval = FXI_INTERVAL);
+
+	size_t get_interval() const { return interval; }
+	uint64_t get_num_records() const { return num_records; }
+	uint64_t get_file_size() const { return stamp.file_size; }
+	const vector<FxiEntry_t>& get_entries() const { return entries; }
+
+	void add(uint64_t record, uint64_t offset) { entries.push_back({ record, offset }); }
+	void finish(uint64_t num_records, const FxiStamp_t& stamp);
+
+	// True if the index was written for this version of the file
+	bool matches(const FxiStamp_t& stamp) const { return this->stamp == stamp; }
+
+	void save(const string& path) const;
+
+	// Returns false if there is no index at path or it has an older format
+	bool load(const string& path);
+
+	// Returns the last indexed record at or before record
+	FxiEntry_t seek(uint64_t record) const;
+
+	// Cuts the file into at most num_ranges ranges that start at indexed records
+	vector<ByteRange_t> split(size_t num_ranges) const;
+
+private:
+	size_t interval;
+	uint64_t num_records = 0;
+	FxiStamp_t stamp;
+	vector<FxiEntry_t> entries;
+};
+
+string get_index_path(const char* in_name);
+
+FxiStamp_t get_file_stamp(const char* path);
+
+// Loads the index next to in_name. Returns false if there is none or it was written for another version of the file.
+bool load_index(FxiIndex* index, const char* in_name);
+
+// Finishes ctx->index with the counters of a full pass and writes it next to the input file
+void write_index(FastxContext_t* ctx);
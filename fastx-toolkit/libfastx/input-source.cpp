@@ -0,0 +1,316 @@
+#ifdef FASTX_WITH_ZLIB
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include "input-source.hpp"
+#include "perf-counters.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+constexpr size_t GZIP_IN_BUF_SIZE = 262144;
+constexpr size_t BGZF_HEADER_SIZE = 18;
+constexpr size_t BGZF_FOOTER_SIZE = 8;
+constexpr size_t BGZF_MAX_BLOCK_SIZE = 65536;
+constexpr size_t BGZF_BLOCKS_PER_THREAD = 4;
+
+static uint16_t read_le16(const unsigned char* p)
+{
+	return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const unsigned char* p)
+{
+	return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// BGZF is gzip with FEXTRA set and a 'BC' subfield carrying the block size
+static bool is_bgzf_header(const unsigned char* p, size_t size)
+{
+	return size >= BGZF_HEADER_SIZE
+		&& p[0] == GZIP_MAGIC[0] && p[1] == GZIP_MAGIC[1] && p[2] == Z_DEFLATED && (p[3] & 0x04)
+		&& read_le16(p + 10) == 6 && p[12] == 'B' && p[13] == 'C' && read_le16(p + 14) == 2;
+}
+
+GzipSource::GzipSource(FILE* stream, size_t num_threads)
+	: stream(stream), num_threads(num_threads ? num_threads : max(thread::hardware_concurrency(), 1u)), in_buf(GZIP_IN_BUF_SIZE)
+{
+	fill_input(BGZF_HEADER_SIZE);
+
+	if (in_size < 2 || in_buf[0] != GZIP_MAGIC[0] || in_buf[1] != GZIP_MAGIC[1])
+		throw runtime_error("Invalid gzip header");
+
+	if (is_bgzf_header(in_buf.data(), in_size))
+	{
+		compression = Compression::COMPRESSION_BGZF;
+		bgzf_blocks.resize(this->num_threads * BGZF_BLOCKS_PER_THREAD);
+
+		for (size_t i = 0; i < this->num_threads; ++i)
+			workers.emplace_back(&GzipSource::run_bgzf_worker, this);
+	}
+	else if (inflateInit2(&zs, 15 + 16) != Z_OK)
+		throw runtime_error("Failed to initialize zlib");
+}
+
+GzipSource::~GzipSource()
+{
+	if (compression == Compression::COMPRESSION_GZIP)
+		inflateEnd(&zs);
+
+	{
+		lock_guard<mutex> lock(mtx);
+		stop = true;
+	}
+
+	queued_cv.notify_all();
+
+	for (thread& worker : workers)
+		worker.join();
+}
+
+bool GzipSource::fill_input(size_t min_size)
+{
+	if (in_size - in_pos >= min_size)
+		return true;
+
+	if (in_pos > 0)
+	{
+		memmove(in_buf.data(), in_buf.data() + in_pos, in_size - in_pos);
+		in_size -= in_pos;
+		in_pos = 0;
+	}
+
+	while (!in_eof && in_size < min_size)
+	{
+		size_t num_read_bytes = fread(in_buf.data() + in_size, sizeof(char), in_buf.size() - in_size, stream);
+
+		if (num_read_bytes == 0)
+			in_eof = true;
+
+		in_size += num_read_bytes;
+	}
+
+	return in_size - in_pos >= min_size;
+}
+
+int GzipSource::peek()
+{
+	if (!has_peeked)
+		has_peeked = (compression == Compression::COMPRESSION_BGZF ? read_bgzf(&peeked, 1) : read_gzip(&peeked, 1)) == 1;
+
+	return has_peeked ? static_cast<unsigned char>(peeked) : EOF;
+}
+
+size_t GzipSource::read(char* dst, size_t size)
+{
+	size_t num_peeked = 0;
+
+	if (size == 0)
+		return 0;
+
+	if (has_peeked)
+	{
+		*dst++ = peeked;
+		--size;
+		has_peeked = false;
+		num_peeked = 1;
+	}
+
+	return num_peeked + (compression == Compression::COMPRESSION_BGZF ? read_bgzf(dst, size) : read_gzip(dst, size));
+}
+
+size_t GzipSource::read_gzip(char* dst, size_t size)
+{
+	FASTX_TRACE_SCOPE("inflate_gzip");
+	zs.next_out = reinterpret_cast<Bytef*>(dst);
+	zs.avail_out = static_cast<uInt>(size);
+
+	while (zs.avail_out > 0 && !stream_end)
+	{
+		if (in_pos == in_size && !fill_input(1))
+			throw runtime_error("Truncated gzip stream");
+
+		zs.next_in = in_buf.data() + in_pos;
+		zs.avail_in = static_cast<uInt>(in_size - in_pos);
+
+		int ret = inflate(&zs, Z_NO_FLUSH);
+
+		in_pos = in_size - zs.avail_in;
+
+		if (ret == Z_STREAM_END)
+		{
+			// Concatenated members continue the same stream
+			if (fill_input(1))
+				inflateReset(&zs);
+			else
+				stream_end = true;
+		}
+		else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			throw runtime_error(format("Failed to inflate gzip stream: {}", zs.msg ? zs.msg : "unknown error"));
+	}
+
+	return size - zs.avail_out;
+}
+
+bool GzipSource::read_bgzf_block(BgzfBlock_t* block)
+{
+	if (!fill_input(BGZF_HEADER_SIZE))
+	{
+		if (in_size - in_pos > 0)
+			throw runtime_error("Truncated BGZF block header");
+
+		return false;
+	}
+
+	if (!is_bgzf_header(in_buf.data() + in_pos, in_size - in_pos))
+		throw runtime_error("Invalid BGZF block header");
+
+	size_t block_size = read_le16(in_buf.data() + in_pos + 16) + static_cast<size_t>(1);
+
+	if (block_size < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE || !fill_input(block_size))
+		throw runtime_error("Truncated BGZF block");
+
+	const unsigned char* data = in_buf.data() + in_pos;
+	const unsigned char* footer = data + block_size - BGZF_FOOTER_SIZE;
+
+	block->deflated.assign(data + BGZF_HEADER_SIZE, footer);
+	block->crc = read_le32(footer);
+	block->isize = read_le32(footer + 4);
+
+	if (block->isize > BGZF_MAX_BLOCK_SIZE)
+		throw runtime_error(format("BGZF block too large: {}", block->isize));
+
+	in_pos += block_size;
+
+	return true;
+}
+
+static void inflate_bgzf_block(BgzfBlock_t* block)
+{
+	FASTX_TRACE_SCOPE("inflate_bgzf_block");
+	FASTX_PERF_SCOPE(PERF_STAGE_READ);
+	z_stream bzs = {};
+
+	block->inflated.resize(block->isize);
+
+	if (inflateInit2(&bzs, -15) != Z_OK)
+		throw runtime_error("Failed to initialize zlib");
+
+	bzs.next_in = block->deflated.data();
+	bzs.avail_in = static_cast<uInt>(block->deflated.size());
+	bzs.next_out = reinterpret_cast<Bytef*>(block->inflated.data());
+	bzs.avail_out = static_cast<uInt>(block->inflated.size());
+
+	int ret = inflate(&bzs, Z_FINISH);
+	inflateEnd(&bzs);
+
+	if (ret != Z_STREAM_END || bzs.avail_out != 0)
+		throw runtime_error("Failed to inflate BGZF block");
+
+	if (crc32(0, reinterpret_cast<const Bytef*>(block->inflated.data()), block->isize) != block->crc)
+		throw runtime_error("BGZF block CRC mismatch");
+}
+
+void GzipSource::run_bgzf_worker()
+{
+	FASTX_TRACE_THREAD("inflate");
+
+	while (true)
+	{
+		BgzfBlock_t* block = nullptr;
+
+		{
+			unique_lock<mutex> lock(mtx);
+			queued_cv.wait(lock, [this] { return stop || !queued_blocks.empty(); });
+
+			if (stop)
+				return;
+
+			block = queued_blocks.front();
+			queued_blocks.pop_front();
+		}
+
+		try
+		{
+			inflate_bgzf_block(block);
+		}
+		catch (...)
+		{
+			// Rethrown by read_bgzf when the block is due
+			block->error = current_exception();
+		}
+
+		{
+			lock_guard<mutex> lock(mtx);
+			block->done = true;
+		}
+
+		done_cv.notify_one();
+	}
+}
+
+void GzipSource::queue_bgzf_blocks()
+{
+	// Every free slot of the ring gets the next compressed block
+	while (!bgzf_eof && num_bgzf_blocks < bgzf_blocks.size())
+	{
+		BgzfBlock_t* block = &bgzf_blocks[(bgzf_block_idx + num_bgzf_blocks) % bgzf_blocks.size()];
+
+		if (!read_bgzf_block(block))
+		{
+			bgzf_eof = true;
+			break;
+		}
+
+		{
+			lock_guard<mutex> lock(mtx);
+			block->done = false;
+			queued_blocks.push_back(block);
+		}
+
+		queued_cv.notify_one();
+		++num_bgzf_blocks;
+	}
+}
+
+size_t GzipSource::read_bgzf(char* dst, size_t size)
+{
+	size_t num_copied = 0;
+
+	while (num_copied < size)
+	{
+		queue_bgzf_blocks();
+
+		if (num_bgzf_blocks == 0)
+			break;
+
+		BgzfBlock_t& block = bgzf_blocks[bgzf_block_idx];
+
+		if (bgzf_block_pos == 0)
+		{
+			FASTX_TRACE_SCOPE("wait_inflate");
+			unique_lock<mutex> lock(mtx);
+			done_cv.wait(lock, [&block] { return block.done; });
+		}
+
+		if (block.error)
+			rethrow_exception(block.error);
+
+		size_t copy_size = min(size - num_copied, block.inflated.size() - bgzf_block_pos);
+
+		copy(block.inflated.begin() + bgzf_block_pos, block.inflated.begin() + bgzf_block_pos + copy_size, dst + num_copied);
+		num_copied += copy_size;
+		bgzf_block_pos += copy_size;
+
+		if (bgzf_block_pos == block.inflated.size())
+		{
+			bgzf_block_idx = (bgzf_block_idx + 1) % bgzf_blocks.size();
+			bgzf_block_pos = 0;
+			--num_bgzf_blocks;
+		}
+	}
+
+	return num_copied;
+}
+#endif
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef FASTX_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+constexpr unsigned char GZIP_MAGIC[] = { 0x1f, 0x8b };
+
+enum class Compression : uint8_t
+{
+	COMPRESSION_NONE,
+	COMPRESSION_GZIP,
+	COMPRESSION_BGZF,
+};
+
+class InputSource
+{
+public:
+	virtual ~InputSource() = default;
+
+	// Reads up to size bytes. Returns 0 at the end of input
+	virtual size_t read(char* dst, size_t size) = 0;
+};
+
+class FileSource : public InputSource
+{
+public:
+	explicit FileSource(FILE* stream) : stream(stream) {}
+
+	size_t read(char* dst, size_t size) override { return fread(dst, sizeof(char), size, stream); }
+
+private:
+	FILE* stream;
+};
+
+#ifdef FASTX_WITH_ZLIB
+typedef struct BgzfBlock_s
+{
+	vector<unsigned char> deflated;
+	vector<char> inflated;
+	uint32_t crc = 0;
+	uint32_t isize = 0;
+	bool done = false; // Set by the worker that inflated it
+	exception_ptr error;
+} BgzfBlock_t;
+
+// Decompresses gzip input. BGZF blocks are independent, so a pool of workers inflates them while the reading
+// thread queues the next compressed blocks and copies inflated ones out in input order.
+class GzipSource : public InputSource
+{
+public:
+	GzipSource(FILE* stream, size_t num_threads);
+	~GzipSource();
+
+	GzipSource(const GzipSource&) = delete;
+	GzipSource& operator=(const GzipSource&) = delete;
+
+	size_t read(char* dst, size_t size) override;
+
+	// Returns the first decompressed byte without consuming it, or EOF
+	int peek();
+
+	Compression get_compression() const { return compression; }
+
+private:
+	size_t read_gzip(char* dst, size_t size);
+	size_t read_bgzf(char* dst, size_t size);
+
+	bool fill_input(size_t min_size);
+	bool read_bgzf_block(BgzfBlock_t* block);
+	void queue_bgzf_blocks();
+	void run_bgzf_worker();
+
+	FILE* stream;
+	Compression compression = Compression::COMPRESSION_GZIP;
+	size_t num_threads;
+
+	vector<unsigned char> in_buf;
+	size_t in_pos = 0;
+	size_t in_size = 0;
+	bool in_eof = false;
+
+	z_stream zs = {};
+	bool stream_end = false;
+
+	// Ring of blocks in input order: num_bgzf_blocks from bgzf_block_idx are queued or inflated
+	vector<BgzfBlock_t> bgzf_blocks;
+	size_t num_bgzf_blocks = 0;
+	size_t bgzf_block_idx = 0;
+	size_t bgzf_block_pos = 0;
+	bool bgzf_eof = false;
+
+	deque<BgzfBlock_t*> queued_blocks;
+	bool stop = false;
+
+	mutex mtx;
+	condition_variable queued_cv;
+	condition_variable done_cv;
+	vector<thread> workers;
+
+	char peeked = 0;
+	bool has_peeked = false;
+};
+#endif
@@ -0,0 +1,109 @@
+#include <bit>
+#include <cstring>
+#include "fastx.hpp"
+#include "line-index.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FASTX_LINE_INDEX_X86
+#include <immintrin.h>
+#endif
+
+#if defined(FASTX_LINE_INDEX_X86) && (defined(__GNUC__) || defined(__clang__))
+#define FASTX_TARGET_AVX2 __attribute__((target("avx2")))
+#define FASTX_HAS_AVX2_KERNEL
+#elif defined(FASTX_LINE_INDEX_X86) && defined(__AVX2__)
+#define FASTX_TARGET_AVX2
+#define FASTX_HAS_AVX2_KERNEL
+#endif
+
+using namespace std;
+
+template <typename MaskType>
+static inline size_t append_eols(MaskType mask, size_t base, uint32_t* eols, size_t num_eols)
+{
+	while (mask)
+	{
+		eols[num_eols++] = static_cast<uint32_t>(base + countr_zero(mask));
+		mask &= mask - 1;
+	}
+
+	return num_eols;
+}
+
+static size_t index_lines_scalar(const char* data, size_t size, size_t pos, uint32_t* eols, size_t num_eols)
+{
+	const char* eol = data + pos;
+
+	while ((eol = reinterpret_cast<const char*>(memchr(eol, LINE_FEED, data + size - eol))) != nullptr)
+	{
+		eols[num_eols++] = static_cast<uint32_t>(eol - data);
+		++eol;
+	}
+
+	return num_eols;
+}
+
+#ifdef FASTX_LINE_INDEX_X86
+static size_t index_lines_sse2(const char* data, size_t size, uint32_t* eols)
+{
+	const __m128i lf = _mm_set1_epi8(LINE_FEED);
+	size_t num_eols = 0;
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf)));
+
+		num_eols = append_eols(mask, i, eols, num_eols);
+	}
+
+	return index_lines_scalar(data, size, i, eols, num_eols);
+}
+#endif
+
+#ifdef FASTX_HAS_AVX2_KERNEL
+FASTX_TARGET_AVX2 static size_t index_lines_avx2(const char* data, size_t size, uint32_t* eols)
+{
+	const __m256i lf = _mm256_set1_epi8(LINE_FEED);
+	size_t num_eols = 0;
+	size_t i = 0;
+
+	for (; i + 64 <= size; i += 64)
+	{
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+		uint64_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, lf)));
+
+		mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, lf)))) << 32;
+		num_eols = append_eols(mask, i, eols, num_eols);
+	}
+
+	return index_lines_scalar(data, size, i, eols, num_eols);
+}
+
+static bool cpu_has_avx2()
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return true; // Built with /arch:AVX2
+#endif
+}
+#endif
+
+size_t index_lines(const char* data, size_t size, uint32_t* eols)
+{
+#ifdef FASTX_HAS_AVX2_KERNEL
+	static const bool use_avx2 = cpu_has_avx2();
+
+	if (use_avx2)
+		return index_lines_avx2(data, size, eols);
+#endif
+
+#ifdef FASTX_LINE_INDEX_X86
+	return index_lines_sse2(data, size, eols);
+#else
+	return index_lines_scalar(data, size, 0, eols, 0);
+#endif
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Bytes indexed per sweep. Windows grow when a single record does not fit.
+constexpr size_t LINE_INDEX_WINDOW = 262144;
+
+// Stores the offset of every LINE_FEED in data[0, size) into eols and returns the count.
+// eols must hold at least size entries.
+size_t index_lines(const char* data, size_t size, uint32_t* eols);
@@ -0,0 +1,248 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include "perf-counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+typedef struct PerfTotals_s
+{
+	size_t calls = 0;
+	uint64_t time = 0;
+	uint64_t cpu_time = 0;
+	uint64_t values[PERF_COUNTER_COUNT] = { 0 };
+} PerfTotals_t;
+
+static const char* PERF_STAGE_NAMES[PERF_STAGE_COUNT] = { "read", "parse", "aggregate", "generate", "output" };
+static const char* PERF_COUNTER_NAMES[PERF_COUNTER_COUNT] = { "cycles", "instructions", "LLC-misses", "branch-misses", "dTLB-misses" };
+
+atomic<bool> perf_enabled = false;
+
+static mutex perf_mtx;
+static PerfTotals_t perf_totals[PERF_STAGE_COUNT];
+static bool perf_available[PERF_COUNTER_COUNT] = { false }; // Opened on at least one thread
+static int perf_errno = 0; // First failure to open a counter
+static thread_local bool perf_in_scope = false;
+
+#ifdef __linux__
+// One group per thread, read with a single syscall. Counters the kernel refuses are left out.
+class PerfGroup
+{
+public:
+	PerfGroup()
+	{
+		for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+		{
+			int fd = open_counter(static_cast<PerfCounter>(i), leader_fd);
+
+			if (fd < 0)
+				continue;
+
+			if (leader_fd < 0)
+				leader_fd = fd;
+
+			fds[num_slots] = fd;
+			slots[num_slots++] = i;
+		}
+
+		lock_guard<mutex> lock(perf_mtx);
+
+		for (size_t i = 0; i < num_slots; ++i)
+			perf_available[slots[i]] = true;
+	}
+
+	~PerfGroup()
+	{
+		for (size_t i = 0; i < num_slots; ++i)
+			close(fds[i]);
+	}
+
+	PerfGroup(const PerfGroup&) = delete;
+	PerfGroup& operator=(const PerfGroup&) = delete;
+
+	void read_values(uint64_t* values) const
+	{
+		uint64_t buf[1 + PERF_COUNTER_COUNT] = { 0 };
+
+		if (leader_fd < 0 || read(leader_fd, buf, sizeof(buf)) < static_cast<ssize_t>(sizeof(uint64_t) * (1 + num_slots)))
+			return;
+
+		for (size_t i = 0; i < num_slots; ++i)
+			values[slots[i]] = buf[1 + i];
+	}
+
+private:
+	static int open_counter(PerfCounter counter, int group_fd)
+	{
+		perf_event_attr attr = {};
+
+		attr.size = sizeof(attr);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		switch (counter)
+		{
+		case PerfCounter::PERF_COUNTER_CYCLES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case PerfCounter::PERF_COUNTER_INSTRUCTIONS:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case PerfCounter::PERF_COUNTER_LLC_MISSES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			break;
+		case PerfCounter::PERF_COUNTER_BRANCH_MISSES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+			break;
+		default:
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+		}
+
+		// Calling thread on any CPU
+		int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+
+		if (fd < 0)
+		{
+			lock_guard<mutex> lock(perf_mtx);
+
+			if (!perf_errno)
+				perf_errno = errno;
+		}
+
+		return fd;
+	}
+
+	int leader_fd = -1;
+	int fds[PERF_COUNTER_COUNT] = { 0 };
+	size_t slots[PERF_COUNTER_COUNT] = { 0 };
+	size_t num_slots = 0;
+};
+
+static const PerfGroup& get_local_group()
+{
+	static thread_local PerfGroup group;
+
+	return group;
+}
+#endif
+
+void perf_sample(PerfSample_t* sample)
+{
+#ifdef __linux__
+	get_local_group().read_values(sample->values);
+#endif
+	sample->time = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	timespec ts;
+
+	// Excludes the time a stage spent blocked, like the hardware counters
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		sample->cpu_time = static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+}
+
+void perf_record(PerfStage stage, const PerfSample_t& begin, const PerfSample_t& end)
+{
+	PerfTotals_t& totals = perf_totals[static_cast<size_t>(stage)];
+	lock_guard<mutex> lock(perf_mtx);
+
+	totals.calls++;
+	totals.time += end.time - begin.time;
+	totals.cpu_time += end.cpu_time - begin.cpu_time;
+
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+		totals.values[i] += end.values[i] - begin.values[i];
+}
+
+bool perf_enter()
+{
+	// Nested stages (a BGZF block inflated inside a read) are counted by the outermost scope
+	if (perf_in_scope)
+		return false;
+
+	perf_in_scope = true;
+
+	return true;
+}
+
+void perf_leave()
+{
+	perf_in_scope = false;
+}
+
+void perf_start()
+{
+#ifdef __linux__
+	get_local_group();
+#else
+	perf_errno = ENOSYS;
+#endif
+	perf_enabled = true;
+}
+
+void perf_report(FILE* stream)
+{
+	bool any_available = false;
+
+	perf_enabled = false;
+
+	lock_guard<mutex> lock(perf_mtx);
+
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+		any_available |= perf_available[i];
+
+	if (!any_available)
+		fprintf(stream, "Hardware counters unavailable (%s), reporting time only\n", strerror(perf_errno));
+
+	// Time is summed over threads, so a stage run by several threads can exceed the wall time
+	fprintf(stream, "%-10s %10s %12s %12s", "stage", "calls", "time_ms", "cpu_ms");
+
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+		if (perf_available[i])
+			fprintf(stream, " %14s", PERF_COUNTER_NAMES[i]);
+
+	if (perf_available[static_cast<size_t>(PerfCounter::PERF_COUNTER_CYCLES)] && perf_available[static_cast<size_t>(PerfCounter::PERF_COUNTER_INSTRUCTIONS)])
+		fprintf(stream, " %6s", "IPC");
+
+	fprintf(stream, "\n");
+
+	for (size_t i = 0; i < PERF_STAGE_COUNT; ++i)
+	{
+		const PerfTotals_t& totals = perf_totals[i];
+
+		if (totals.calls == 0)
+			continue;
+
+		fprintf(stream, "%-10s %10zu %12.3f %12.3f", PERF_STAGE_NAMES[i], totals.calls, totals.time / 1e6, totals.cpu_time / 1e6);
+
+		for (size_t j = 0; j < PERF_COUNTER_COUNT; ++j)
+			if (perf_available[j])
+				fprintf(stream, " %14llu", static_cast<unsigned long long>(totals.values[j]));
+
+		if (perf_available[static_cast<size_t>(PerfCounter::PERF_COUNTER_CYCLES)] && perf_available[static_cast<size_t>(PerfCounter::PERF_COUNTER_INSTRUCTIONS)])
+		{
+			uint64_t cycles = totals.values[static_cast<size_t>(PerfCounter::PERF_COUNTER_CYCLES)];
+			uint64_t instructions = totals.values[static_cast<size_t>(PerfCounter::PERF_COUNTER_INSTRUCTIONS)];
+
+			fprintf(stream, " %6.2f", cycles ? static_cast<double>(instructions) / cycles : 0.0);
+		}
+
+		fprintf(stream, "\n");
+	}
+}
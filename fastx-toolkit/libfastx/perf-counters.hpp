@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+using namespace std;
+
+// Per-stage hardware counter report. Every thread opens its own perf_event_open group on first use and the
+// outermost stage scope of a thread adds its counter deltas to the stage totals. Without counter access
+// (non-Linux, perf_event_paranoid, no PMU in a VM) only wall time, thread CPU time and scope counts are reported.
+enum class PerfStage : uint8_t
+{
+	PERF_STAGE_READ,      // Input reads and decompression
+	PERF_STAGE_PARSE,     // Record assembly and .fxb decoding
+	PERF_STAGE_AGGREGATE, // The tool's per-record work and the merging of partial results
+	PERF_STAGE_GENERATE,  // Synthetic record generation
+	PERF_STAGE_OUTPUT,    // Report formatting and output writes
+	_PERF_STAGE_COUNT_,
+};
+
+enum class PerfCounter : uint8_t
+{
+	PERF_COUNTER_CYCLES,
+	PERF_COUNTER_INSTRUCTIONS,
+	PERF_COUNTER_LLC_MISSES,
+	PERF_COUNTER_BRANCH_MISSES,
+	PERF_COUNTER_DTLB_MISSES,
+	_PERF_COUNTER_COUNT_,
+};
+
+constexpr size_t PERF_STAGE_COUNT = static_cast<size_t>(PerfStage::_PERF_STAGE_COUNT_);
+constexpr size_t PERF_COUNTER_COUNT = static_cast<size_t>(PerfCounter::_PERF_COUNTER_COUNT_);
+
+typedef struct PerfSample_s
+{
+	uint64_t time = 0; // Nanoseconds
+	uint64_t cpu_time = 0; // Nanoseconds the calling thread ran
+	uint64_t values[PERF_COUNTER_COUNT] = { 0 };
+} PerfSample_t;
+
+extern atomic<bool> perf_enabled;
+
+void perf_start();
+
+// Stops counting and prints the stage totals. Call once the counted threads are done.
+void perf_report(FILE* stream);
+
+void perf_sample(PerfSample_t* sample);
+void perf_record(PerfStage stage, const PerfSample_t& begin, const PerfSample_t& end);
+bool perf_enter();
+void perf_leave();
+
+class PerfScope
+{
+public:
+	explicit PerfScope(PerfStage stage) : stage(stage), active(perf_enabled.load(memory_order_relaxed) && perf_enter())
+	{
+		if (active)
+			perf_sample(&begin);
+	}
+
+	~PerfScope()
+	{
+		if (!active)
+			return;
+
+		PerfSample_t end;
+
+		perf_sample(&end);
+		perf_record(stage, begin, end);
+		perf_leave();
+	}
+
+	PerfScope(const PerfScope&) = delete;
+	PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+	PerfStage stage;
+	bool active;
+	PerfSample_t begin;
+};
+
+#define FASTX_PERF_CONCAT_(a, b) a##b
+#define FASTX_PERF_CONCAT(a, b) FASTX_PERF_CONCAT_(a, b)
+#define FASTX_PERF_SCOPE(stage) PerfScope FASTX_PERF_CONCAT(perf_scope_, __LINE__)(PerfStage::stage)
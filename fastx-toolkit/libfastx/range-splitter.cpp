@@ -0,0 +1,84 @@
+#include <cstring>
+#include "range-splitter.hpp"
+
+using namespace std;
+
+static size_t next_line_start(const char* data, size_t size, size_t pos)
+{
+	const char* eol = reinterpret_cast<const char*>(memchr(data + pos, LINE_FEED, size - pos));
+
+	return eol ? eol - data + 1 : size;
+}
+
+size_t find_record_start(const char* data, size_t size, size_t pos, FileFormat format)
+{
+	const size_t member_count = RECORD_MEMBER_COUNTS[static_cast<uint8_t>(format)];
+	const char signature = FILE_SIGNATURES[static_cast<uint8_t>(format)];
+
+	if (member_count == 0)
+		return size;
+
+	// Move to the start of a line
+	if (pos > 0 && pos < size && data[pos - 1] != LINE_FEED)
+		pos = next_line_start(data, size, pos);
+
+	for (; pos < size; pos = next_line_start(data, size, pos))
+	{
+		if (data[pos] != signature)
+			continue;
+
+		if (format == FileFormat::FILE_FORMAT_FASTA)
+			return pos;
+
+		// A quality line may start with '@' too. A real header is followed by the
+		// sequence, a '+' separator and a quality line of the same length.
+		size_t lines[5] = { pos };
+
+		for (size_t i = 1; i < 5; ++i)
+			lines[i] = next_line_start(data, size, lines[i - 1]);
+
+		if (lines[4] == size && (lines[3] == size || data[size - 1] != LINE_FEED))
+			return size;
+
+		if (data[lines[2]] == '+' && lines[2] - lines[1] == lines[4] - lines[3])
+			return pos;
+	}
+
+	return size;
+}
+
+vector<ByteRange_t> split_ranges(const char* data, size_t size, FileFormat format, size_t num_ranges)
+{
+	vector<ByteRange_t> ranges;
+	size_t begin = 0;
+
+	num_ranges = max(num_ranges, static_cast<size_t>(1));
+
+	for (size_t i = 1; i <= num_ranges && begin < size; ++i)
+	{
+		size_t end = i == num_ranges ? size : find_record_start(data, size, max(begin, size / num_ranges * i), format);
+
+		if (end > begin)
+			ranges.push_back({ begin, end });
+
+		begin = end;
+	}
+
+	return ranges;
+}
+
+bool starts_records(const char* data, size_t size, const vector<ByteRange_t>& ranges, FileFormat format)
+{
+	const char signature = FILE_SIGNATURES[static_cast<uint8_t>(format)];
+
+	for (const auto& range : ranges)
+	{
+		if (range.begin >= size || range.end > size || data[range.begin] != signature)
+			return false;
+
+		if (range.begin > 0 && data[range.begin - 1] != LINE_FEED)
+			return false;
+	}
+
+	return true;
+}
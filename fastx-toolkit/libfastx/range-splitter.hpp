@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "fastx.hpp"
+
+using namespace std;
+
+typedef struct ByteRange_s
+{
+	size_t begin = 0;
+	size_t end = 0;
+} ByteRange_t;
+
+// Returns the offset of the first record starting at or after pos, or size if there is none
+size_t find_record_start(const char* data, size_t size, size_t pos, FileFormat format);
+
+// Cuts data into at most num_ranges non-empty ranges that each start at a record boundary
+vector<ByteRange_t> split_ranges(const char* data, size_t size, FileFormat format, size_t num_ranges);
+
+// True if every range starts a record: at the start of the data or of a line, on the record signature.
+// Catches ranges taken from an index of another version of the data.
+bool starts_records(const char* data, size_t size, const vector<ByteRange_t>& ranges, FileFormat format);
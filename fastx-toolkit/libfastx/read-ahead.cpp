@@ -0,0 +1,115 @@
+#include <stdexcept>
+#include "perf-counters.hpp"
+#include "read-ahead.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+ReadAhead::ReadAhead(InputSource* source, size_t block_size, size_t prefix_size, size_t num_blocks)
+	: source(source), block_size(block_size), prefix_size(prefix_size), blocks(num_blocks)
+{
+	// One block is held by the consumer while the next one is acquired
+	if (num_blocks < 2)
+		throw invalid_argument("Read-ahead needs at least 2 buffers");
+
+	for (ReadBlock_t& block : blocks)
+	{
+		block.storage.resize(prefix_size + block_size);
+		free_blocks.push_back(&block);
+	}
+
+	worker = thread(&ReadAhead::run, this);
+}
+
+ReadAhead::~ReadAhead()
+{
+	{
+		lock_guard<mutex> lock(mtx);
+		stop = true;
+	}
+
+	cv.notify_all();
+	worker.join();
+}
+
+void ReadAhead::run()
+{
+	FASTX_TRACE_THREAD("read-ahead");
+
+	while (true)
+	{
+		ReadBlock_t* block = nullptr;
+
+		{
+			unique_lock<mutex> lock(mtx);
+			cv.wait(lock, [this] { return stop || !free_blocks.empty(); });
+
+			if (stop)
+				return;
+
+			block = free_blocks.front();
+			free_blocks.pop_front();
+		}
+
+		try
+		{
+			FASTX_TRACE_SCOPE("read");
+			FASTX_PERF_SCOPE(PERF_STAGE_READ);
+			block->size = source->read(get_data(block), block_size);
+		}
+		catch (...)
+		{
+			// Decompression errors are rethrown to the consumer
+			lock_guard<mutex> lock(mtx);
+			error = current_exception();
+			block->size = 0;
+		}
+
+		{
+			lock_guard<mutex> lock(mtx);
+
+			if (block->size > 0)
+				filled_blocks.push_back(block);
+			else
+			{
+				free_blocks.push_back(block);
+				done = true;
+			}
+		}
+
+		cv.notify_all();
+
+		if (block->size == 0)
+			return;
+	}
+}
+
+ReadBlock_t* ReadAhead::acquire()
+{
+	FASTX_TRACE_SCOPE("wait_input");
+	unique_lock<mutex> lock(mtx);
+	cv.wait(lock, [this] { return done || !filled_blocks.empty(); });
+
+	if (filled_blocks.empty())
+	{
+		if (error)
+			rethrow_exception(error);
+
+		return nullptr;
+	}
+
+	ReadBlock_t* block = filled_blocks.front();
+	filled_blocks.pop_front();
+
+	return block;
+}
+
+void ReadAhead::release(ReadBlock_t* block)
+{
+	{
+		lock_guard<mutex> lock(mtx);
+		free_blocks.push_back(block);
+	}
+
+	cv.notify_all();
+}
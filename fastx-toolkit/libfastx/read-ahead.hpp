@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "input-source.hpp"
+
+using namespace std;
+
+typedef struct ReadBlock_s
+{
+	vector<char> storage; // prefix_size bytes of headroom, then the block
+	size_t size = 0;
+} ReadBlock_t;
+
+// Fills a ring of blocks from an input source on a background thread.
+// The headroom in front of each block takes the partial record carried over from the previous one.
+class ReadAhead
+{
+public:
+	ReadAhead(InputSource* source, size_t block_size, size_t prefix_size, size_t num_blocks);
+	~ReadAhead();
+
+	ReadAhead(const ReadAhead&) = delete;
+	ReadAhead& operator=(const ReadAhead&) = delete;
+
+	// Returns the next filled block, or nullptr at the end of input
+	ReadBlock_t* acquire();
+	void release(ReadBlock_t* block);
+
+	char* get_data(ReadBlock_t* block) const { return block->storage.data() + prefix_size; }
+	size_t get_prefix_size() const { return prefix_size; }
+
+private:
+	void run();
+
+	InputSource* source;
+	size_t block_size;
+	size_t prefix_size;
+
+	vector<ReadBlock_t> blocks;
+	deque<ReadBlock_t*> free_blocks;
+	deque<ReadBlock_t*> filled_blocks;
+	bool done = false;
+	bool stop = false;
+	exception_ptr error;
+
+	mutex mtx;
+	condition_variable cv;
+	thread worker;
+};
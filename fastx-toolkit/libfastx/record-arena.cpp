@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <stdexcept>
+#include "record-arena.hpp"
+
+using namespace std;
+
+RecordArena::RecordArena(size_t chunk_size) : chunk_size(chunk_size)
+{
+	if (chunk_size == 0)
+		throw invalid_argument("Arena chunk size must be positive");
+}
+
+char* RecordArena::allocate(size_t size)
+{
+	for (; curr_chunk < chunks.size(); ++curr_chunk)
+	{
+		ArenaChunk_t& chunk = chunks[curr_chunk];
+
+		if (chunk.storage.size() - chunk.used >= size)
+		{
+			char* data = chunk.storage.data() + chunk.used;
+			chunk.used += size;
+
+			return data;
+		}
+	}
+
+	// Chunks are never moved, so earlier allocations stay valid
+	chunks.emplace_back();
+	chunks.back().storage.resize(max(chunk_size, size));
+	chunks.back().used = size;
+
+	return chunks.back().storage.data();
+}
+
+static inline const char* pack_member(const char* member, size_t len, char*& data)
+{
+	if (!member)
+		return nullptr;
+
+	char* packed = data;
+
+	data = copy(member, member + len, data);
+
+	return packed;
+}
+
+void RecordArena::pack(FastxRecordView_t* record)
+{
+	char* data = allocate(record->seq_id_len + record->seq_len + record->desc_len + record->qual_len);
+
+	record->seq_id = pack_member(record->seq_id, record->seq_id_len, data);
+	record->seq = pack_member(record->seq, record->seq_len, data);
+	record->desc = pack_member(record->desc, record->desc_len, data);
+	record->qual = pack_member(record->qual, record->qual_len, data);
+}
+
+void RecordArena::reset()
+{
+	for (ArenaChunk_t& chunk : chunks)
+		chunk.used = 0;
+
+	curr_chunk = 0;
+}
+
+size_t RecordArena::get_capacity() const
+{
+	size_t capacity = 0;
+
+	for (const ArenaChunk_t& chunk : chunks)
+		capacity += chunk.storage.size();
+
+	return capacity;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "fastx.hpp"
+
+using namespace std;
+
+constexpr size_t DEFAULT_ARENA_CHUNK_SIZE = 1 << 20;
+
+// Bump allocator for record bytes. Memory stays valid until reset(), which keeps the chunks for reuse.
+class RecordArena
+{
+public:
+	explicit RecordArena(size_t chunk_size = DEFAULT_ARENA_CHUNK_SIZE);
+
+	RecordArena(const RecordArena&) = delete;
+	RecordArena& operator=(const RecordArena&) = delete;
+
+	char* allocate(size_t size);
+
+	// Copies the members of record into one contiguous run and points the view at it
+	void pack(FastxRecordView_t* record);
+
+	void reset();
+
+	size_t get_capacity() const;
+
+private:
+	typedef struct ArenaChunk_s
+	{
+		vector<char> storage;
+		size_t used = 0;
+	} ArenaChunk_t;
+
+	size_t chunk_size;
+	vector<ArenaChunk_t> chunks;
+	size_t curr_chunk = 0;
+};
@@ -0,0 +1,134 @@
+#include <stdexcept>
+#include "record-pipeline.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+void fill_pool(RecordPool_t* pool, span<const FastxRecordView_t> batch)
+{
+	pool->arena.reset();
+	pool->records.assign(batch.begin(), batch.end());
+
+	for (FastxRecordView_t& record : pool->records)
+		pool->arena.pack(&record);
+}
+
+RecordPipeline::RecordPipeline(size_t num_pools, size_t queue_depth) : queue_depth(queue_depth)
+{
+	// One pool is filled while another one is aggregated
+	if (num_pools < 2)
+		throw invalid_argument("Record pipeline needs at least 2 pools");
+
+	if (queue_depth == 0)
+		throw invalid_argument("Record pipeline queue depth must be positive");
+
+	for (size_t i = 0; i < num_pools; ++i)
+	{
+		pools.push_back(make_unique<RecordPool_t>());
+		free_pools.push_back(pools.back().get());
+	}
+}
+
+RecordPool_t* RecordPipeline::acquire()
+{
+	FASTX_TRACE_SCOPE("wait_pool");
+	unique_lock<mutex> lock(mtx);
+	producer_cv.wait(lock, [this] { return failed || !free_pools.empty(); });
+
+	if (failed)
+		return nullptr;
+
+	RecordPool_t* pool = free_pools.front();
+	free_pools.pop_front();
+
+	return pool;
+}
+
+void RecordPipeline::push(RecordPool_t* pool)
+{
+	{
+		FASTX_TRACE_SCOPE("wait_queue");
+		unique_lock<mutex> lock(mtx);
+		producer_cv.wait(lock, [this] { return failed || filled_pools.size() < queue_depth; });
+
+		if (failed)
+		{
+			free_pools.push_back(pool);
+			return;
+		}
+
+		filled_pools.push_back(pool);
+	}
+
+	consumer_cv.notify_one();
+}
+
+void RecordPipeline::close()
+{
+	{
+		lock_guard<mutex> lock(mtx);
+		closed = true;
+	}
+
+	consumer_cv.notify_all();
+}
+
+RecordPool_t* RecordPipeline::pop()
+{
+	RecordPool_t* pool = nullptr;
+
+	{
+		FASTX_TRACE_SCOPE("wait_records");
+		unique_lock<mutex> lock(mtx);
+		consumer_cv.wait(lock, [this] { return failed || closed || !filled_pools.empty(); });
+
+		if (failed || filled_pools.empty())
+			return nullptr;
+
+		pool = filled_pools.front();
+		filled_pools.pop_front();
+	}
+
+	// A queue slot opened up
+	producer_cv.notify_all();
+
+	return pool;
+}
+
+void RecordPipeline::release(RecordPool_t* pool)
+{
+	{
+		lock_guard<mutex> lock(mtx);
+		free_pools.push_back(pool);
+	}
+
+	producer_cv.notify_all();
+}
+
+void RecordPipeline::fail(exception_ptr error)
+{
+	{
+		lock_guard<mutex> lock(mtx);
+
+		if (!this->error)
+			this->error = error;
+
+		failed = true;
+	}
+
+	producer_cv.notify_all();
+	consumer_cv.notify_all();
+}
+
+void RecordPipeline::rethrow_error()
+{
+	exception_ptr first_error;
+
+	{
+		lock_guard<mutex> lock(mtx);
+		first_error = error;
+	}
+
+	if (first_error)
+		rethrow_exception(first_error);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+#include "fastx.hpp"
+#include "record-arena.hpp"
+
+using namespace std;
+
+// A batch of records that owns its bytes, so it outlives the reader's buffers
+typedef struct RecordPool_s
+{
+	vector<FastxRecordView_t> records;
+	RecordArena arena;
+} RecordPool_t;
+
+// Copies the records of a batch into pool, replacing its contents
+void fill_pool(RecordPool_t* pool, span<const FastxRecordView_t> batch);
+
+// Bounded queue of record pools between a parser and aggregation workers.
+// A fixed set of pools circulates: the parser fills free pools, workers take filled ones and release them back.
+class RecordPipeline
+{
+public:
+	// At most queue_depth filled pools wait for the workers
+	RecordPipeline(size_t num_pools, size_t queue_depth);
+
+	RecordPipeline(const RecordPipeline&) = delete;
+	RecordPipeline& operator=(const RecordPipeline&) = delete;
+
+	// Producer side. acquire() returns a free pool, or nullptr once the pipeline failed.
+	RecordPool_t* acquire();
+	void push(RecordPool_t* pool);
+	void close();
+
+	// Consumer side. pop() returns the next filled pool, or nullptr once the pipeline is closed and drained or failed.
+	RecordPool_t* pop();
+	void release(RecordPool_t* pool);
+
+	// Stops both sides; the first error is kept for rethrow_error()
+	void fail(exception_ptr error);
+	void rethrow_error();
+
+private:
+	vector<unique_ptr<RecordPool_t>> pools;
+	deque<RecordPool_t*> free_pools;
+	deque<RecordPool_t*> filled_pools;
+	size_t queue_depth;
+	bool closed = false;
+	bool failed = false;
+	exception_ptr error;
+
+	mutex mtx;
+	condition_variable producer_cv;
+	condition_variable consumer_cv;
+};
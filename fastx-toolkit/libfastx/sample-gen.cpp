@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cstring>
+#include "sample-gen.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FASTX_SAMPLE_GEN_X86
+#include <immintrin.h>
+#endif
+
+#if defined(FASTX_SAMPLE_GEN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define FASTX_TARGET_AVX2 __attribute__((target("avx2")))
+#define FASTX_HAS_AVX2_KERNEL
+#elif defined(FASTX_SAMPLE_GEN_X86) && defined(__AVX2__)
+#define FASTX_TARGET_AVX2
+#define FASTX_HAS_AVX2_KERNEL
+#endif
+
+using namespace std;
+
+// Random words are drawn in batches and expanded by the widest kernel the CPU supports.
+// Every kernel produces the same layout, so the output depends only on the stream:
+//   nucleotides: 16 random bytes r[0, 16) give 64 bases, base[k * 16 + j] = NUC_LUT[(r[j] >> 2k) & 3]
+//   characters:  each little-endian 16-bit lane u gives lo + (u * width >> 16)
+constexpr size_t GEN_WORD_BATCH = 64;
+constexpr size_t NUCS_PER_GROUP = 64; // Two words
+constexpr size_t CHARS_PER_WORD = 4;
+
+static void fill_words(uint64_t* words, size_t num_words, SampleRng& rng)
+{
+	for (size_t i = 0; i < num_words; ++i)
+		words[i] = rng();
+}
+
+#ifndef FASTX_SAMPLE_GEN_X86
+static const char NUC_LUT[4] = { 'A', 'C', 'G', 'T' };
+
+static void expand_nucs_scalar(const uint8_t* bytes, size_t num_groups, char* dst)
+{
+	for (size_t group = 0; group < num_groups; ++group, bytes += 16, dst += NUCS_PER_GROUP)
+		for (size_t k = 0; k < 4; ++k)
+			for (size_t j = 0; j < 16; ++j)
+				dst[k * 16 + j] = NUC_LUT[(bytes[j] >> (2 * k)) & 3];
+}
+#endif
+
+static inline void expand_chars_scalar(const uint8_t* bytes, size_t num_words, char* dst, uint8_t lo, uint32_t width)
+{
+	for (size_t i = 0; i < num_words * CHARS_PER_WORD; ++i)
+	{
+		uint32_t lane = bytes[2 * i] | (static_cast<uint32_t>(bytes[2 * i + 1]) << 8);
+
+		dst[i] = static_cast<char>(lo + ((lane * width) >> 16));
+	}
+}
+
+#ifdef FASTX_SAMPLE_GEN_X86
+// Without a byte shuffle the four codes are mapped by comparisons: A + 2 (>= C) + 4 (>= G) + 13 (>= T)
+static inline __m128i map_nucs_sse2(__m128i codes)
+{
+	__m128i c = _mm_and_si128(_mm_cmpgt_epi8(codes, _mm_setzero_si128()), _mm_set1_epi8('C' - 'A'));
+	__m128i g = _mm_and_si128(_mm_cmpgt_epi8(codes, _mm_set1_epi8(1)), _mm_set1_epi8('G' - 'C'));
+	__m128i t = _mm_and_si128(_mm_cmpgt_epi8(codes, _mm_set1_epi8(2)), _mm_set1_epi8('T' - 'G'));
+
+	return _mm_add_epi8(_mm_add_epi8(_mm_set1_epi8('A'), c), _mm_add_epi8(g, t));
+}
+
+static inline void expand_nucs_sse2(const uint8_t* bytes, size_t num_groups, char* dst)
+{
+	const __m128i mask = _mm_set1_epi8(3);
+
+	for (size_t group = 0; group < num_groups; ++group, bytes += 16, dst += NUCS_PER_GROUP)
+	{
+		__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+
+		// 16-bit shifts pull in bits of the neighbouring byte, which the mask drops
+		for (int k = 0; k < 4; ++k)
+		{
+			__m128i codes = _mm_and_si128(_mm_srli_epi16(r, 2 * k), mask);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + k * 16), map_nucs_sse2(codes));
+		}
+	}
+}
+
+static inline void expand_chars_sse2(const uint8_t* bytes, size_t num_words, char* dst, uint8_t lo, uint32_t width)
+{
+	const __m128i w = _mm_set1_epi16(static_cast<short>(width));
+	const __m128i base = _mm_set1_epi16(lo);
+	size_t i = 0;
+
+	for (; i + 4 <= num_words; i += 4)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i * 8));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i * 8 + 16));
+
+		a = _mm_add_epi16(_mm_mulhi_epu16(a, w), base);
+		b = _mm_add_epi16(_mm_mulhi_epu16(b, w), base);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * CHARS_PER_WORD), _mm_packus_epi16(a, b));
+	}
+
+	expand_chars_scalar(bytes + i * 8, num_words - i, dst + i * CHARS_PER_WORD, lo, width);
+}
+#endif
+
+#ifdef FASTX_HAS_AVX2_KERNEL
+FASTX_TARGET_AVX2 static void expand_nucs_avx2(const uint8_t* bytes, size_t num_groups, char* dst)
+{
+	const __m256i mask = _mm256_set1_epi8(3);
+	const __m256i lut = _mm256_setr_epi8('A', 'C', 'G', 'T', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		'A', 'C', 'G', 'T', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	size_t group = 0;
+
+	// Two groups per iteration: the low 128-bit lanes belong to the first, the high lanes to the second
+	for (; group + 2 <= num_groups; group += 2, bytes += 32, dst += 2 * NUCS_PER_GROUP)
+	{
+		__m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+		__m256i n0 = _mm256_shuffle_epi8(lut, _mm256_and_si256(r, mask));
+		__m256i n1 = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(r, 2), mask));
+		__m256i n2 = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(r, 4), mask));
+		__m256i n3 = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(r, 6), mask));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(n0, n1, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(n2, n3, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 64), _mm256_permute2x128_si256(n0, n1, 0x31));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 96), _mm256_permute2x128_si256(n2, n3, 0x31));
+	}
+
+	// Inlined, so the tail is VEX-encoded too: calling legacy-SSE code with dirty upper lanes stalls
+	expand_nucs_sse2(bytes, num_groups - group, dst);
+}
+
+FASTX_TARGET_AVX2 static void expand_chars_avx2(const uint8_t* bytes, size_t num_words, char* dst, uint8_t lo, uint32_t width)
+{
+	const __m256i w = _mm256_set1_epi16(static_cast<short>(width));
+	const __m256i base = _mm256_set1_epi16(lo);
+	size_t i = 0;
+
+	for (; i + 8 <= num_words; i += 8)
+	{
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i * 8));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i * 8 + 32));
+
+		a = _mm256_add_epi16(_mm256_mulhi_epu16(a, w), base);
+		b = _mm256_add_epi16(_mm256_mulhi_epu16(b, w), base);
+
+		// packus works per 128-bit lane; restore the lane order
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * CHARS_PER_WORD), packed);
+	}
+
+	expand_chars_sse2(bytes + i * 8, num_words - i, dst + i * CHARS_PER_WORD, lo, width);
+}
+
+static bool cpu_has_avx2()
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return true; // Built with /arch:AVX2
+#endif
+}
+#endif
+
+static void expand_nucs(const uint64_t* words, size_t num_groups, char* dst)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(words);
+
+#ifdef FASTX_HAS_AVX2_KERNEL
+	static const bool use_avx2 = cpu_has_avx2();
+
+	if (use_avx2)
+		return expand_nucs_avx2(bytes, num_groups, dst);
+#endif
+
+#ifdef FASTX_SAMPLE_GEN_X86
+	expand_nucs_sse2(bytes, num_groups, dst);
+#else
+	expand_nucs_scalar(bytes, num_groups, dst);
+#endif
+}
+
+static void expand_chars(const uint64_t* words, size_t num_words, char* dst, uint8_t lo, uint32_t width)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(words);
+
+#ifdef FASTX_HAS_AVX2_KERNEL
+	static const bool use_avx2 = cpu_has_avx2();
+
+	if (use_avx2)
+		return expand_chars_avx2(bytes, num_words, dst, lo, width);
+#endif
+
+#ifdef FASTX_SAMPLE_GEN_X86
+	expand_chars_sse2(bytes, num_words, dst, lo, width);
+#else
+	expand_chars_scalar(bytes, num_words, dst, lo, width);
+#endif
+}
+
+void gen_rand_chars(char* dst, size_t len, SampleRng& rng, uint8_t lo, uint8_t hi)
+{
+	uint64_t words[GEN_WORD_BATCH];
+	uint32_t width = static_cast<uint32_t>(hi) - lo + 1;
+
+	while (len >= CHARS_PER_WORD)
+	{
+		size_t num_words = min(len / CHARS_PER_WORD, GEN_WORD_BATCH);
+
+		fill_words(words, num_words, rng);
+		expand_chars(words, num_words, dst, lo, width);
+		dst += num_words * CHARS_PER_WORD;
+		len -= num_words * CHARS_PER_WORD;
+	}
+
+	if (len > 0)
+	{
+		char tail[CHARS_PER_WORD];
+
+		fill_words(words, 1, rng);
+		expand_chars(words, 1, tail, lo, width);
+		memcpy(dst, tail, len);
+	}
+}
+
+void gen_rand_nucs(char* dst, size_t len, SampleRng& rng)
+{
+	uint64_t words[GEN_WORD_BATCH];
+	constexpr size_t max_groups = GEN_WORD_BATCH / 2;
+
+	while (len >= NUCS_PER_GROUP)
+	{
+		size_t num_groups = min(len / NUCS_PER_GROUP, max_groups);
+
+		fill_words(words, num_groups * 2, rng);
+		expand_nucs(words, num_groups, dst);
+		dst += num_groups * NUCS_PER_GROUP;
+		len -= num_groups * NUCS_PER_GROUP;
+	}
+
+	if (len > 0)
+	{
+		char tail[NUCS_PER_GROUP];
+
+		fill_words(words, 2, rng);
+		expand_nucs(words, 1, tail);
+		memcpy(dst, tail, len);
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+using namespace std;
+
+constexpr size_t GEN_BLOCK_RECORDS = 4096; // Records generated from one random stream
+
+// Counter-based generator (SplitMix64). Each (seed, stream) pair starts at its own hashed point of the
+// 2^64 cycle, so blocks of records can be generated on any thread and in any order.
+class SampleRng
+{
+public:
+	typedef uint64_t result_type;
+
+	SampleRng(uint64_t seed, uint64_t stream) : state(mix(seed ^ mix(stream + GOLDEN_GAMMA))) {}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return UINT64_MAX; }
+
+	result_type operator()()
+	{
+		state += GOLDEN_GAMMA;
+
+		return mix(state);
+	}
+
+private:
+	static constexpr uint64_t GOLDEN_GAMMA = 0x9E3779B97F4A7C15;
+
+	static uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+
+		return z ^ (z >> 31);
+	}
+
+	uint64_t state;
+};
+
+// Bulk random character kernels of fastx-samp-gen. Each fills dst[0, len) from 64-bit draws of rng,
+// expanded with SIMD where available; the output is the same on every CPU.
+
+// Characters drawn uniformly from [lo, hi], four per draw
+void gen_rand_chars(char* dst, size_t len, SampleRng& rng, uint8_t lo, uint8_t hi);
+
+// Nucleotides drawn uniformly from A, C, G and T, 2 bits each
+void gen_rand_nucs(char* dst, size_t len, SampleRng& rng);
@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <format>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+#include "sample-profile.hpp"
+
+using namespace std;
+
+static const char* V2_HEADER = "cycle\tmax_count\t";
+static const char PROFILE_NUCS[PROFILE_BASE_COUNT] = { 'A', 'C', 'G', 'T', 'N' };
+
+static string read_text(const string& path)
+{
+	FILE* stream = nullptr;
+	string text;
+	char buf[65536];
+	size_t len;
+
+	open_file(path.c_str(), "rb", &stream);
+
+	while ((len = fread(buf, 1, sizeof(buf), stream)) > 0)
+		text.append(buf, len);
+
+	bool result = !ferror(stream);
+	fclose(stream);
+
+	if (!result)
+		throw runtime_error(format("Failed to read profile: {}", path));
+
+	return text;
+}
+
+static vector<string_view> split_lines(string_view text)
+{
+	vector<string_view> lines;
+
+	while (!text.empty())
+	{
+		size_t end = text.find(LINE_FEED);
+		string_view line = text.substr(0, end);
+
+		if (!line.empty() && line.back() == CARRIAGE_RETN)
+			line.remove_suffix(1);
+
+		lines.push_back(line);
+		text.remove_prefix(end == string_view::npos ? text.size() : end + 1);
+	}
+
+	return lines;
+}
+
+static vector<string_view> split_fields(string_view line, const char* delims)
+{
+	vector<string_view> fields;
+
+	while (true)
+	{
+		size_t begin = line.find_first_not_of(delims);
+
+		if (begin == string_view::npos)
+			break;
+
+		size_t end = line.find_first_of(delims, begin);
+		fields.push_back(line.substr(begin, end - begin));
+
+		if (end == string_view::npos)
+			break;
+
+		line.remove_prefix(end);
+	}
+
+	return fields;
+}
+
+template<typename T>
+static T parse_value(string_view field, size_t line_no)
+{
+	T value;
+	from_chars_result result = from_chars(field.data(), field.data() + field.size(), value);
+
+	if (result.ec != errc() || result.ptr != field.data() + field.size())
+		throw runtime_error(format("Invalid profile value at line {}: {}", line_no, field));
+
+	return value;
+}
+
+static void check_knots(const int16_t* knots, size_t line_no)
+{
+	bool result = knots[0] >= MIN_QUALITY && knots[PROFILE_KNOT_COUNT - 1] <= MAX_QUALITY;
+
+	for (size_t i = 1; i < PROFILE_KNOT_COUNT; ++i)
+		result &= knots[i - 1] <= knots[i];
+
+	if (!result)
+		throw runtime_error(format("Invalid quality quantiles at line {}: expected {} <= MIN <= Q1 <= MED <= Q3 <= MAX <= {}", line_no, MIN_QUALITY, MAX_QUALITY));
+}
+
+// Linear between the listed cycles, constant outside them
+template<typename T, size_t N>
+static void interpolate(const map<uint32_t, array<T, N>>& points, uint32_t cycle, T* dst)
+{
+	auto hi = points.lower_bound(cycle);
+
+	if (hi == points.end())
+		hi = prev(hi);
+
+	if (hi->first <= cycle || hi == points.begin())
+	{
+		copy(hi->second.begin(), hi->second.end(), dst);
+		return;
+	}
+
+	auto lo = prev(hi);
+	double t = static_cast<double>(cycle - lo->first) / (hi->first - lo->first);
+
+	for (size_t i = 0; i < N; ++i)
+	{
+		double value = lo->second[i] + (hi->second[i] - lo->second[i]) * t;
+		dst[i] = is_integral_v<T> ? static_cast<T>(lround(value)) : static_cast<T>(value);
+	}
+}
+
+static void parse_spec(const vector<string_view>& lines, SampleProfile_t* profile)
+{
+	map<uint32_t, array<int16_t, PROFILE_KNOT_COUNT>> quals;
+	map<uint32_t, array<double, PROFILE_BASE_COUNT>> bases;
+	uint32_t num_cycles = 1;
+
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		size_t line_no = i + 1;
+		vector<string_view> fields = split_fields(lines[i].substr(0, lines[i].find('#')), " \t");
+
+		if (fields.empty())
+			continue;
+
+		string_view key = fields[0];
+		size_t num_values = fields.size() - 1;
+
+		if (key == "quality" && num_values == 1 + PROFILE_KNOT_COUNT)
+		{
+			uint32_t cycle = parse_value<uint32_t>(fields[1], line_no);
+
+			if (cycle == 0)
+				throw runtime_error(format("Invalid profile cycle at line {}: cycles start at 1", line_no));
+
+			array<int16_t, PROFILE_KNOT_COUNT>& knots = quals[cycle];
+
+			for (size_t j = 0; j < PROFILE_KNOT_COUNT; ++j)
+				knots[j] = parse_value<int16_t>(fields[2 + j], line_no);
+
+			check_knots(knots.data(), line_no);
+			num_cycles = max(num_cycles, cycle);
+		}
+		else if (key == "bases" && num_values == 1 + PROFILE_BASE_COUNT)
+		{
+			uint32_t cycle = parse_value<uint32_t>(fields[1], line_no);
+
+			if (cycle == 0)
+				throw runtime_error(format("Invalid profile cycle at line {}: cycles start at 1", line_no));
+
+			array<double, PROFILE_BASE_COUNT>& weights = bases[cycle];
+
+			for (size_t j = 0; j < PROFILE_BASE_COUNT; ++j)
+			{
+				weights[j] = parse_value<double>(fields[2 + j], line_no);
+
+				if (weights[j] < 0)
+					throw runtime_error(format("Invalid base weight at line {}: {}", line_no, fields[2 + j]));
+			}
+
+			num_cycles = max(num_cycles, cycle);
+		}
+		else if (key == "length" && num_values == 2)
+		{
+			size_t dash = fields[1].find('-');
+			uint32_t lo = parse_value<uint32_t>(fields[1].substr(0, dash), line_no);
+			uint32_t hi = dash == string_view::npos ? lo : parse_value<uint32_t>(fields[1].substr(dash + 1), line_no);
+			double weight = parse_value<double>(fields[2], line_no);
+
+			if (lo == 0 || lo > hi || hi > MAX_SEQUENCE_LENGTH || weight < 0)
+				throw runtime_error(format("Invalid read length at line {}: expected 1 <= LO <= HI <= {} and WEIGHT >= 0", line_no, MAX_SEQUENCE_LENGTH));
+
+			for (uint32_t len = lo; len <= hi; ++len)
+				profile->lengths.emplace_back(len, weight / (hi - lo + 1));
+
+			num_cycles = max(num_cycles, hi);
+		}
+		else if (key == "bins" && num_values > 0)
+		{
+			for (size_t j = 1; j < fields.size(); ++j)
+			{
+				int bin = parse_value<int>(fields[j], line_no);
+
+				if (bin < MIN_QUALITY || bin > MAX_QUALITY)
+					throw runtime_error(format("Invalid quality bin at line {}: {}", line_no, bin));
+
+				profile->qual_bins.push_back(bin);
+			}
+		}
+		else if (key == "duplicates" && num_values == 1)
+		{
+			profile->dup_rate = parse_value<double>(fields[1], line_no);
+
+			if (!(profile->dup_rate >= 0 && profile->dup_rate < 1))
+				throw runtime_error(format("Invalid duplicate rate at line {}: expected [0, 1)", line_no));
+		}
+		else
+			throw runtime_error(format("Invalid profile line {}: {}", line_no, lines[i]));
+	}
+
+	profile->cycles.resize(num_cycles);
+
+	for (uint32_t cycle = 1; cycle <= num_cycles; ++cycle)
+	{
+		CycleProfile_t& cycle_profile = profile->cycles[cycle - 1];
+
+		if (!quals.empty())
+		{
+			cycle_profile.has_qual = true;
+			interpolate(quals, cycle, cycle_profile.qual_knots);
+		}
+
+		if (!bases.empty())
+			interpolate(bases, cycle, cycle_profile.base_weights);
+	}
+}
+
+// Rows hold quantiles per cycle, and ALL_count of cycle c counts the reads of length >= c
+static void parse_v2_stats(const vector<string_view>& lines, SampleProfile_t* profile)
+{
+	static const char* QUAL_COLUMNS[PROFILE_KNOT_COUNT] = { "ALL_min", "ALL_Q1", "ALL_med", "ALL_Q3", "ALL_max" };
+	static const char* COUNT_COLUMNS[PROFILE_BASE_COUNT] = { "A_count", "C_count", "G_count", "T_count", "N_count" };
+
+	vector<string_view> header = split_fields(lines[0], "\t");
+	vector<uint64_t> read_counts;
+
+	auto find_column = [&](string_view name)
+		{
+			auto it = find(header.begin(), header.end(), name);
+
+			if (it == header.end())
+				throw runtime_error(format("Invalid fastx-qual-stats v2 output: missing column {}", name));
+
+			return static_cast<size_t>(it - header.begin());
+		};
+
+	size_t all_count_idx = find_column("ALL_count");
+	size_t qual_idxs[PROFILE_KNOT_COUNT];
+	size_t count_idxs[PROFILE_BASE_COUNT];
+
+	for (size_t j = 0; j < PROFILE_KNOT_COUNT; ++j)
+		qual_idxs[j] = find_column(QUAL_COLUMNS[j]);
+
+	for (size_t j = 0; j < PROFILE_BASE_COUNT; ++j)
+		count_idxs[j] = find_column(COUNT_COLUMNS[j]);
+
+	for (size_t i = 1; i < lines.size(); ++i)
+	{
+		size_t line_no = i + 1;
+		vector<string_view> fields = split_fields(lines[i], "\t");
+
+		if (fields.empty())
+			continue;
+
+		if (fields.size() != header.size())
+			throw runtime_error(format("Invalid fastx-qual-stats v2 output at line {}: expected {} fields, got {}", line_no, header.size(), fields.size()));
+
+		if (parse_value<uint64_t>(fields[0], line_no) != profile->cycles.size() + 1)
+			throw runtime_error(format("Invalid fastx-qual-stats v2 output at line {}: cycles must be consecutive", line_no));
+
+		CycleProfile_t cycle_profile;
+		int min_qual = parse_value<int>(fields[qual_idxs[0]], line_no);
+		int max_qual = parse_value<int>(fields[qual_idxs[PROFILE_KNOT_COUNT - 1]], line_no);
+
+		// FASTA statistics keep the initial min > max
+		cycle_profile.has_qual = min_qual <= max_qual;
+
+		if (cycle_profile.has_qual)
+		{
+			for (size_t j = 0; j < PROFILE_KNOT_COUNT; ++j)
+				cycle_profile.qual_knots[j] = parse_value<int16_t>(fields[qual_idxs[j]], line_no);
+
+			check_knots(cycle_profile.qual_knots, line_no);
+		}
+
+		for (size_t j = 0; j < PROFILE_BASE_COUNT; ++j)
+			cycle_profile.base_weights[j] = static_cast<double>(parse_value<uint64_t>(fields[count_idxs[j]], line_no));
+
+		read_counts.push_back(parse_value<uint64_t>(fields[all_count_idx], line_no));
+		profile->cycles.push_back(cycle_profile);
+	}
+
+	if (profile->cycles.empty())
+		throw runtime_error("Invalid fastx-qual-stats v2 output: no cycles");
+
+	if (profile->cycles.size() > MAX_SEQUENCE_LENGTH)
+		throw runtime_error(format("Invalid fastx-qual-stats v2 output: more than {} cycles", MAX_SEQUENCE_LENGTH));
+
+	for (size_t i = 0; i < read_counts.size(); ++i)
+	{
+		uint64_t longer = i + 1 < read_counts.size() ? read_counts[i + 1] : 0;
+
+		if (read_counts[i] > longer)
+			profile->lengths.emplace_back(static_cast<uint32_t>(i + 1), static_cast<double>(read_counts[i] - longer));
+	}
+}
+
+void load_profile(const string& path, SampleProfile_t* profile)
+{
+	string text = read_text(path);
+	vector<string_view> lines = split_lines(text);
+
+	*profile = SampleProfile_t();
+
+	if (!lines.empty() && lines[0].starts_with(V2_HEADER))
+		parse_v2_stats(lines, profile);
+	else
+		parse_spec(lines, profile);
+}
+
+void save_profile(const string& path, const SampleProfile_t& profile)
+{
+	FILE* stream = nullptr;
+	string text = "# fastx-samp-gen profile\n";
+
+	for (size_t i = 0; i < profile.cycles.size(); ++i)
+	{
+		const CycleProfile_t& cycle_profile = profile.cycles[i];
+		const int16_t* knots = cycle_profile.qual_knots;
+		const double* weights = cycle_profile.base_weights;
+
+		if (cycle_profile.has_qual)
+			text += format("quality {} {} {} {} {} {}\n", i + 1, knots[0], knots[1], knots[2], knots[3], knots[4]);
+
+		text += format("bases {} {} {} {} {} {}\n", i + 1, weights[0], weights[1], weights[2], weights[3], weights[4]);
+	}
+
+	for (const auto& [len, weight] : profile.lengths)
+		text += format("length {} {}\n", len, weight);
+
+	if (!profile.qual_bins.empty())
+	{
+		text += "bins";
+
+		for (int bin : profile.qual_bins)
+			text += format(" {}", bin);
+
+		text += '\n';
+	}
+
+	if (profile.dup_rate > 0)
+		text += format("duplicates {}\n", profile.dup_rate);
+
+	open_file(path.c_str(), "wb", &stream);
+
+	bool result = fwrite(text.data(), 1, text.size(), stream) == text.size();
+	result &= fclose(stream) == 0;
+
+	if (!result)
+		throw runtime_error(format("Failed to write profile: {}", path));
+}
+
+ProfileSampler::ProfileSampler(const SampleProfile_t& profile, int min_qual, int max_qual, char base_qual_offset)
+{
+	size_t num_cycles = max(profile.cycles.size(), static_cast<size_t>(1));
+
+	// The fallback knots index qual_chars, so they stay within the quality buckets
+	min_qual = clamp(min_qual, MIN_QUALITY, MAX_QUALITY);
+	max_qual = clamp(max_qual, min_qual, MAX_QUALITY);
+
+	cycles.resize(num_cycles);
+
+	for (size_t i = 0; i < num_cycles; ++i)
+	{
+		CycleProfile_t cycle_profile = i < profile.cycles.size() ? profile.cycles[i] : CycleProfile_t();
+		SamplerCycle_t& cycle = cycles[i];
+
+		for (size_t j = 0; j < PROFILE_KNOT_COUNT; ++j)
+		{
+			if (cycle_profile.has_qual)
+				cycle.qual_knots[j] = cycle_profile.qual_knots[j];
+			else
+				cycle.qual_knots[j] = static_cast<int16_t>(min_qual + (max_qual - min_qual) * static_cast<int>(j) / static_cast<int>(PROFILE_KNOT_COUNT - 1));
+		}
+
+		double total = 0;
+		double cum = 0;
+
+		for (double weight : cycle_profile.base_weights)
+			total += weight;
+
+		for (size_t j = 0; j < PROFILE_BASE_COUNT - 1; ++j)
+		{
+			cum += total > 0 ? cycle_profile.base_weights[j] / total : 0.25;
+			cycle.nuc_thresholds[j] = static_cast<uint32_t>(min<long>(lround(cum * 65536), 65536));
+		}
+	}
+
+	double len_total = 0;
+
+	for (const auto& [len, weight] : profile.lengths)
+	{
+		if (weight <= 0)
+			continue;
+
+		len_total += weight;
+		len_values.push_back(len);
+		len_cdf.push_back(len_total);
+	}
+
+	for (double& cum : len_cdf)
+		cum /= len_total;
+
+	if (profile.dup_rate > 0)
+		dup_threshold = static_cast<uint64_t>(ldexp(profile.dup_rate, 64));
+
+	for (int q = MIN_QUALITY; q <= MAX_QUALITY; ++q)
+	{
+		int binned = profile.qual_bins.empty() ? q : profile.qual_bins[0];
+
+		// Ties go to the lower bin
+		for (int bin : profile.qual_bins)
+		{
+			if (abs(bin - q) < abs(binned - q) || (abs(bin - q) == abs(binned - q) && bin < binned))
+				binned = bin;
+		}
+
+		qual_chars[q - MIN_QUALITY] = static_cast<char>(base_qual_offset + binned);
+	}
+}
+
+size_t ProfileSampler::draw_len(SampleRng& rng) const
+{
+	double u = static_cast<double>(rng() >> 11) * 0x1.0p-53;
+	size_t idx = upper_bound(len_cdf.begin(), len_cdf.end(), u) - len_cdf.begin();
+
+	return len_values[min(idx, len_values.size() - 1)];
+}
+
+// Every base takes a 16-bit lane of a draw
+void ProfileSampler::gen_nucs(char* dst, size_t len, SampleRng& rng) const
+{
+	for (size_t i = 0; i < len; i += 4)
+	{
+		uint64_t word = rng();
+
+		for (size_t j = i; j < min(i + 4, len); ++j, word >>= 16)
+		{
+			uint32_t u = static_cast<uint32_t>(word & 0xFFFF);
+			const uint32_t* thresholds = get_cycle(j).nuc_thresholds;
+
+			dst[j] = PROFILE_NUCS[(u >= thresholds[0]) + (u >= thresholds[1]) + (u >= thresholds[2]) + (u >= thresholds[3])];
+		}
+	}
+}
+
+// The top 2 bits of a lane pick a quantile segment, the other 14 interpolate within it
+void ProfileSampler::gen_quals(char* dst, const char* seq, size_t len, SampleRng& rng) const
+{
+	for (size_t i = 0; i < len; i += 4)
+	{
+		uint64_t word = rng();
+
+		for (size_t j = i; j < min(i + 4, len); ++j, word >>= 16)
+		{
+			uint32_t u = static_cast<uint32_t>(word & 0xFFFF);
+			const int16_t* knots = get_cycle(j).qual_knots;
+			uint32_t seg = u >> 14;
+			int frac = static_cast<int>(u & 0x3FFF);
+			int qual = knots[seg] + (((knots[seg + 1] - knots[seg]) * frac + 0x2000) >> 14);
+
+			if (seq[j] == 'N')
+				qual = knots[0];
+
+			dst[j] = qual_chars[qual - MIN_QUALITY];
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "column-stats.hpp"
+#include "sample-gen.hpp"
+
+using namespace std;
+
+// Workload profile of fastx-samp-gen: per-cycle quality quantiles and base composition, read lengths,
+// quality bins and a duplicate rate. It is read from a spec file or derived from fastx-qual-stats v2 output.
+//
+// Spec file, one entry per line, # starts a comment:
+//   quality CYCLE MIN Q1 MED Q3 MAX  quality quantiles of a 1-based cycle
+//   bases CYCLE A C G T N           base weights of a cycle
+//   length LEN WEIGHT               weight of a read length; LO-HI spreads the weight over a range
+//   bins Q...                       qualities are rounded to the nearest bin
+//   duplicates RATE                 fraction of reads repeating an earlier read, in [0, 1)
+// Cycles between two listed cycles are interpolated, cycles past the last one repeat it.
+constexpr size_t PROFILE_KNOT_COUNT = 5; // Min, Q1, median, Q3 and max
+constexpr size_t PROFILE_BASE_COUNT = 5; // A, C, G, T and N
+
+typedef struct CycleProfile_s
+{
+	bool has_qual = false;
+	int16_t qual_knots[PROFILE_KNOT_COUNT] = { 0 };
+	double base_weights[PROFILE_BASE_COUNT] = { 1, 1, 1, 1, 0 };
+} CycleProfile_t;
+
+typedef struct SampleProfile_s
+{
+	vector<CycleProfile_t> cycles;
+	vector<pair<uint32_t, double>> lengths; // Empty keeps the --mns/--mxs range
+	vector<int> qual_bins;
+	double dup_rate = 0;
+} SampleProfile_t;
+
+// Detects fastx-qual-stats v2 output by its header
+void load_profile(const string& path, SampleProfile_t* profile);
+void save_profile(const string& path, const SampleProfile_t& profile);
+
+// Draws reads from a profile. Cycles without qualities fall back to a uniform [min_qual, max_qual], clamped to
+// [MIN_QUALITY, MAX_QUALITY].
+class ProfileSampler
+{
+public:
+	ProfileSampler(const SampleProfile_t& profile, int min_qual, int max_qual, char base_qual_offset);
+
+	bool has_lengths() const { return !len_values.empty(); }
+	bool has_duplicates() const { return dup_threshold > 0; }
+
+	size_t draw_len(SampleRng& rng) const;
+	bool draw_duplicate(SampleRng& rng) const { return rng() < dup_threshold; }
+
+	void gen_nucs(char* dst, size_t len, SampleRng& rng) const;
+
+	// N bases get the lowest quality of their cycle
+	void gen_quals(char* dst, const char* seq, size_t len, SampleRng& rng) const;
+
+private:
+	typedef struct SamplerCycle_s
+	{
+		int16_t qual_knots[PROFILE_KNOT_COUNT];
+		uint32_t nuc_thresholds[PROFILE_BASE_COUNT - 1]; // Upper bounds of 16-bit draws for A, C, G and T
+	} SamplerCycle_t;
+
+	const SamplerCycle_t& get_cycle(size_t pos) const { return cycles[min(pos, cycles.size() - 1)]; }
+
+	vector<SamplerCycle_t> cycles;
+	vector<uint32_t> len_values;
+	vector<double> len_cdf;
+	uint64_t dup_threshold = 0;
+	char qual_chars[QUALITY_BUCKET_COUNT];
+};
@@ -0,0 +1,147 @@
+#include <charconv>
+#include <vector>
+#include "stats-report.hpp"
+
+using namespace std;
+
+static const vector<string> COMMON_HEADERS = { "count", "min", "max", "sum", "mean", "Q1", "med", "Q3", "IQR", "lW", "rW" };
+
+template <typename T>
+static void append_int(string* out, T value)
+{
+	char buf[24];
+
+	*out += string_view(buf, to_chars(buf, buf + sizeof(buf), value).ptr);
+}
+
+// Same text as printf("%3.2f"): the mean always has at least 4 characters, so the width never pads
+static void append_mean(string* out, double value)
+{
+	char buf[352]; // Fits the longest double in fixed notation
+
+	*out += string_view(buf, to_chars(buf, buf + sizeof(buf), value, chars_format::fixed, 2).ptr);
+}
+
+static void append_headers(string* out, OutputVersion out_ver, Nucleotide nuc = Nucleotide::UNDEFINED)
+{
+	for (const auto& header : COMMON_HEADERS)
+	{
+		*out += '\t';
+
+		if (out_ver == OutputVersion::V2)
+		{
+			if (nuc == Nucleotide::ALL)
+				*out += "ALL";
+			else
+				*out += NUC_CHARS[static_cast<int>(nuc)];
+
+			*out += '_';
+		}
+
+		*out += header;
+	}
+}
+
+static void append_nuc_stats(string* out, const NucleotideStatistics& stats, int min_qual)
+{
+	int64_t q1, med, q3, iqr;
+	int64_t left_wisker, right_wisker;
+
+	q1 = get_nth_value(stats, stats.count / 4, min_qual);
+	med = get_nth_value(stats, stats.count / 2, min_qual);
+	q3 = get_nth_value(stats, stats.count * 3 / 4, min_qual);
+	iqr = q3 - q1;
+
+	left_wisker = q1 - iqr * 3 / 2;
+	right_wisker = q3 + iqr * 3 / 2;
+
+	if (left_wisker < stats.min)
+		left_wisker = stats.min;
+
+	if (right_wisker > stats.max)
+		right_wisker = stats.max;
+
+	append_int(out, stats.count);
+	*out += '\t';
+	append_int(out, stats.min);
+	*out += '\t';
+	append_int(out, stats.max);
+	*out += '\t';
+	append_int(out, stats.sum);
+	*out += '\t';
+	append_mean(out, static_cast<double>(stats.sum) / static_cast<double>(stats.count));
+
+	for (int64_t value : { q1, med, q3, iqr, left_wisker, right_wisker })
+	{
+		*out += '\t';
+		append_int(out, value);
+	}
+}
+
+size_t get_report_rows(const ColumnStatsStore& stats)
+{
+	size_t num_rows = 0;
+
+	while (num_rows < stats.size() && stats.has_bases(num_rows))
+		num_rows++;
+
+	return num_rows;
+}
+
+void format_report_header(string* out, OutputVersion out_ver)
+{
+	if (out_ver == OutputVersion::V1)
+	{
+		*out += "column";
+		append_headers(out, out_ver);
+		*out += "\tA_Count\tC_Count\tG_Count\tT_Count\tN_Count\tMax_count\n";
+		return;
+	}
+
+	*out += "cycle\tmax_count";
+
+	for (int i = 0; i < NUC_CHARS.size(); ++i)
+		append_headers(out, out_ver, static_cast<Nucleotide>(i));
+
+	*out += '\n';
+}
+
+void format_report_rows(string* out, const ColumnStatsStore& stats, size_t begin, size_t end, OutputVersion out_ver, int min_qual)
+{
+	NucleotideStatistics nuc_stats[NUCLEOTIDE_COUNT];
+	uint64_t max_count = stats.empty() ? 0 : stats.get_count(0, ALL);
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		stats.get_column_stats(i, nuc_stats);
+
+		append_int(out, i + 1);
+		*out += '\t';
+
+		if (out_ver == OutputVersion::V1)
+		{
+			append_nuc_stats(out, nuc_stats[ALL], min_qual);
+
+			for (size_t j = 1; j < NUCLEOTIDE_COUNT; ++j)
+			{
+				*out += '\t';
+				append_int(out, nuc_stats[j].count);
+			}
+
+			*out += '\t';
+			append_int(out, max_count);
+		}
+		else
+		{
+			append_int(out, max_count);
+
+			for (size_t j = 0; j < NUCLEOTIDE_COUNT; ++j)
+			{
+				*out += '\t';
+				append_nuc_stats(out, nuc_stats[j], min_qual);
+			}
+		}
+
+		*out += '\n';
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "column-stats.hpp"
+
+using namespace std;
+
+enum class OutputVersion : uint8_t
+{
+	V1, V2, UNDEFINED,
+};
+
+// Rows of fastx-qual-stats output: one per column up to the first column without bases. Rows are formatted
+// with to_chars and depend only on the statistics, so ranges of rows can be formatted concurrently and
+// written in order.
+constexpr size_t REPORT_BLOCK_ROWS = 64; // Rows formatted into one buffer before it is written
+
+size_t get_report_rows(const ColumnStatsStore& stats);
+
+void format_report_header(string* out, OutputVersion out_ver);
+
+// Appends rows [begin, end) to out
+void format_report_rows(string* out, const ColumnStatsStore& stats, size_t begin, size_t end, OutputVersion out_ver, int min_qual);
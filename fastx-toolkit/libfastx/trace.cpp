@@ -0,0 +1,123 @@
+#include <stdexcept>
+#include "trace.hpp"
+
+using namespace std;
+
+#ifdef FASTX_WITH_TRACE
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "fastx.hpp"
+
+typedef struct TraceRing_s
+{
+	vector<TraceEvent_t> events;
+	size_t count = 0;
+	size_t tid = 0;
+	const char* name = nullptr;
+} TraceRing_t;
+
+atomic<bool> trace_enabled = false;
+
+static mutex trace_mtx;
+static vector<shared_ptr<TraceRing_t>> trace_rings; // Outlive their threads
+static uint64_t trace_origin = 0;
+static thread_local shared_ptr<TraceRing_t> local_ring;
+
+uint64_t trace_now()
+{
+	return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static TraceRing_t* get_local_ring()
+{
+	if (!local_ring)
+	{
+		local_ring = make_shared<TraceRing_t>();
+
+		lock_guard<mutex> lock(trace_mtx);
+		local_ring->tid = trace_rings.size();
+		trace_rings.push_back(local_ring);
+	}
+
+	return local_ring.get();
+}
+
+void trace_record(const char* name, uint64_t begin, uint64_t end)
+{
+	TraceRing_t* ring = get_local_ring();
+
+	// Short-lived threads only pay for the events they record
+	if (ring->events.size() < TRACE_RING_SIZE)
+		ring->events.push_back({ name, begin, end });
+	else
+		ring->events[ring->count % TRACE_RING_SIZE] = { name, begin, end };
+
+	ring->count++;
+}
+
+void trace_thread_name(const char* name)
+{
+	if (trace_enabled.load(memory_order_relaxed))
+		get_local_ring()->name = name;
+}
+
+void trace_start()
+{
+	trace_origin = trace_now();
+	trace_enabled = true;
+
+	trace_thread_name("main");
+}
+
+void trace_write(const string& path)
+{
+	FILE* stream = nullptr;
+	bool first = true;
+
+	trace_enabled = false;
+	open_file(path.c_str(), "wb", &stream);
+
+	lock_guard<mutex> lock(trace_mtx);
+
+	fprintf(stream, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	for (const shared_ptr<TraceRing_t>& ring : trace_rings)
+	{
+		size_t num_events = min(ring->count, TRACE_RING_SIZE);
+
+		if (ring->name)
+		{
+			fprintf(stream, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}", first ? "" : ",", ring->tid, ring->name);
+			first = false;
+		}
+
+		for (size_t i = ring->count - num_events; i < ring->count; ++i)
+		{
+			const TraceEvent_t& event = ring->events[i % TRACE_RING_SIZE];
+
+			fprintf(stream, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",",
+				event.name, ring->tid, (event.begin - trace_origin) / 1000.0, (event.end - event.begin) / 1000.0);
+			first = false;
+		}
+	}
+
+	fprintf(stream, "\n]}\n");
+
+	if (ferror(stream) || fclose(stream) != 0)
+		throw runtime_error(format("Failed to write trace: {}", path));
+}
+#else
+void trace_start()
+{
+	throw runtime_error("Tracing is not compiled in. Rebuild with FASTX_TRACE=ON");
+}
+
+void trace_write([[maybe_unused]] const string& path)
+{
+}
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Timeline tracer. Spans go to per-thread rings and are dumped as Chrome trace JSON (chrome://tracing, Perfetto).
+// Built with FASTX_WITH_TRACE; otherwise the macros expand to nothing and trace_start() throws.
+constexpr size_t TRACE_RING_SIZE = 1 << 16; // Events kept per thread; older ones are overwritten
+
+typedef struct TraceEvent_s
+{
+	const char* name;
+	uint64_t begin; // Nanoseconds
+	uint64_t end;
+} TraceEvent_t;
+
+void trace_start();
+
+// Stops tracing and writes every thread's events. Call once the traced threads are done.
+void trace_write(const string& path);
+
+#ifdef FASTX_WITH_TRACE
+#include <atomic>
+
+extern atomic<bool> trace_enabled;
+
+uint64_t trace_now();
+void trace_record(const char* name, uint64_t begin, uint64_t end);
+void trace_thread_name(const char* name);
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) : name(name), begin(trace_enabled.load(memory_order_relaxed) ? trace_now() : 0) {}
+
+	~TraceScope()
+	{
+		if (begin)
+			trace_record(name, begin, trace_now());
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	uint64_t begin;
+};
+
+#define FASTX_TRACE_CONCAT_(a, b) a##b
+#define FASTX_TRACE_CONCAT(a, b) FASTX_TRACE_CONCAT_(a, b)
+#define FASTX_TRACE_SCOPE(name) TraceScope FASTX_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define FASTX_TRACE_THREAD(name) trace_thread_name(name)
+#else
+#define FASTX_TRACE_SCOPE(name) ((void)0)
+#define FASTX_TRACE_THREAD(name) ((void)0)
+#endif
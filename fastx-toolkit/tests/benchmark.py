@@ -0,0 +1,256 @@
+import argparse
+import hashlib
+import json
+import os
+import platform
+import subprocess
+import sys
+from datetime import datetime, timezone
+from os import path
+from statistics import median
+from time import perf_counter
+
+# Input matrix: (name, sample format, min length, max length, crlf, records at --scale 1)
+INPUTS = [
+	("fastq-short-lf", "fastq", 50, 150, False, 1000000),
+	("fastq-short-crlf", "fastq", 50, 150, True, 1000000),
+	("fastq-long-lf", "fastq", 1000, 20000, False, 20000),
+	("fasta-short-lf", "fasta", 50, 150, False, 1000000),
+	("fasta-long-crlf", "fasta", 1000, 20000, True, 20000),
+]
+
+SEED = 42
+BUF_SIZES = [ 32768, 1048576 ]
+
+parser = argparse.ArgumentParser(prog="benchmark.py", description="End-to-end throughput benchmark of the fastx tools", epilog="")
+args = None
+
+def valid_args(args):
+	result = True
+
+	result &= path.isdir(args.bin)
+	result &= path.isdir(args.tmp)
+	result &= args.reps > 0
+	result &= args.scale > 0
+	result &= args.threshold > 0
+
+	if args.baseline:
+		result &= path.isfile(args.baseline)
+
+	if result == False:
+		raise ValueError("Invalid arguments")
+
+def parse_args():
+	global args
+
+	parser.add_argument("-b", "--bin", help="directory of the tool executables", type=str, required=True)
+	parser.add_argument("-t", "--tmp", help="sample and output directory", type=str, required=True)
+	parser.add_argument("-o", "--out", help="result JSON file. default is STDOUT", type=str, default="")
+	parser.add_argument("--baseline", help="result JSON of an earlier run to compare against", type=str, default="")
+	parser.add_argument("--threshold", help="throughput drop in percent flagged as a regression. default is 5", type=float, default=5.0)
+	parser.add_argument("--reps", help="timed runs per variant, the median is kept. default is 3", type=int, default=3)
+	parser.add_argument("--scale", help="multiplies the record count of every input. default is 1", type=float, default=1.0)
+	parser.add_argument("--threads", help="thread counts of the OpenMP tool. default is 1,2,4 and every hardware thread", type=str, default="")
+	parser.add_argument("--keep", help="keep the generated samples for the next run", action="store_true")
+
+	args = parser.parse_args()
+	valid_args(args)
+
+def get_exec(name):
+	exec_path = path.join(args.bin, name + (".exe" if os.name == "nt" else ""))
+
+	if not path.isfile(exec_path):
+		raise ValueError(f"Missing executable: {exec_path}")
+
+	return exec_path
+
+def get_thread_counts():
+	if args.threads:
+		return sorted({ int(num) for num in args.threads.split(",") })
+
+	return sorted({ 1, 2, 4, os.cpu_count() or 1 })
+
+def gen_samp(name, samp_format, min_len, max_len, crlf, num_records):
+	samp_path = path.join(args.tmp, f"{name}-{num_records}.{'fq' if samp_format == 'fastq' else 'fa'}")
+
+	if path.isfile(samp_path):
+		return samp_path
+
+	gen = get_exec("fastx-samp-gen")
+	# A fixed seed keeps the inputs, and so the output hashes, identical between runs
+	command = [ gen, "-s", samp_format, "--nr", str(num_records), "--mns", str(min_len), "--mxs", str(max_len), "--seed", str(SEED), "-o", samp_path ]
+
+	if crlf:
+		command.append("--crlf")
+
+	subprocess.run(command, check=True)
+
+	return samp_path
+
+def hash_file(file_path):
+	digest = hashlib.sha256()
+
+	with open(file_path, "rb") as file:
+		for chunk in iter(lambda: file.read(1 << 20), b""):
+			digest.update(chunk)
+
+	return digest.hexdigest()
+
+# Runs the command once and returns wall seconds, CPU seconds and peak RSS in KiB of the child
+def run_once(command):
+	start_time = perf_counter()
+	proc = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+
+	if hasattr(os, "wait4"):
+		_, status, usage = os.wait4(proc.pid, 0)
+		proc.returncode = os.waitstatus_to_exitcode(status)
+		cpu_time = usage.ru_utime + usage.ru_stime
+		peak_rss = usage.ru_maxrss // (1024 if sys.platform == "darwin" else 1)
+	else:
+		proc.wait()
+		cpu_time = None
+		peak_rss = None
+
+	wall_time = perf_counter() - start_time
+	error = proc.stderr.read().decode(errors="replace")
+	proc.stderr.close()
+
+	if proc.returncode != 0:
+		raise RuntimeError(f"Failed ({proc.returncode}): {' '.join(command)}\n{error}")
+
+	return (wall_time, cpu_time, peak_rss)
+
+def run_variant(tool, samp, variant, command, out_path, out_key):
+	runs = [ run_once(command) for _ in range(args.reps) ]
+	wall_time = median(run[0] for run in runs)
+	cpu_time = median(run[1] for run in runs) if runs[0][1] is not None else None
+	size = path.getsize(samp["path"])
+
+	result = {
+		"tool": tool,
+		"input": samp["name"],
+		"variant": variant,
+		"out_key": out_key,
+		"wall_ms": round(wall_time * 1000, 3),
+		"mb_s": round(size / wall_time / 1e6, 3),
+		"records_s": round(samp["records"] / wall_time, 1),
+		"peak_rss_kb": max(run[2] for run in runs) if runs[0][2] is not None else None,
+		"cpu_util": round(cpu_time / wall_time, 3) if cpu_time is not None else None,
+		"output_sha256": hash_file(out_path),
+	}
+
+	os.remove(out_path)
+	print(f"[{tool}:{samp['name']}:{format_variant(variant)}] {result['wall_ms']}ms, {result['mb_s']}MB/s, {result['records_s']}rec/s", file=sys.stderr)
+
+	return result
+
+def format_variant(variant):
+	return ",".join(f"{key}={value}" for key, value in sorted(variant.items()))
+
+def run_matrix():
+	results = []
+	out_path = path.join(args.tmp, "out")
+	threads = get_thread_counts()
+
+	for (name, samp_format, min_len, max_len, crlf, num_records) in INPUTS:
+		num_records = max(int(num_records * args.scale), 1)
+		samp = { "name": name, "records": num_records, "path": gen_samp(name, samp_format, min_len, max_len, crlf, num_records) }
+
+		for buf_size in BUF_SIZES:
+			if samp_format == "fastq":
+				command = [ get_exec("fastq-to-fasta"), "--ibufs", str(buf_size), "-i", samp["path"], "-o", out_path ]
+				results.append(run_variant("fastq-to-fasta", samp, { "ibufs": buf_size }, command, out_path, "fasta"))
+
+			for out_ver in [ "v1", "v2" ]:
+				command = [ get_exec("fastx-qual-stats"), "--ov", out_ver, "--ibufs", str(buf_size), "-i", samp["path"], "-o", out_path ]
+				results.append(run_variant("fastx-qual-stats", samp, { "ibufs": buf_size, "ov": out_ver }, command, out_path, out_ver))
+
+				for num_threads in threads:
+					command = [ get_exec("fastx-qual-stats-omp"), "--ov", out_ver, "--ths", str(num_threads), "--ibufs", str(buf_size), "-i", samp["path"], "-o", out_path ]
+					results.append(run_variant("fastx-qual-stats-omp", samp, { "ibufs": buf_size, "ov": out_ver, "ths": num_threads }, command, out_path, out_ver))
+
+		if not args.keep:
+			os.remove(samp["path"])
+
+	return results
+
+# Every variant of the same input and output kind must produce the same bytes, whichever tool or tuning produced it
+def verify_outputs(results):
+	groups = {}
+	mismatches = []
+
+	for result in results:
+		groups.setdefault((result["input"], result["out_key"]), []).append(result)
+
+	for (input_name, out_key), group in groups.items():
+		hashes = { result["output_sha256"] for result in group }
+
+		if len(hashes) > 1:
+			mismatches.append({ "input": input_name, "out_key": out_key, "variants": [ (result["tool"], format_variant(result["variant"]), result["output_sha256"]) for result in group ] })
+
+	return mismatches
+
+def get_result_key(result):
+	return (result["tool"], result["input"], format_variant(result["variant"]))
+
+def compare_baseline(results):
+	with open(args.baseline, "r") as file:
+		baseline = { get_result_key(result): result for result in json.load(file)["results"] }
+
+	regressions = []
+
+	print(f"{'tool':<22}{'input':<18}{'variant':<28}{'base MB/s':>10}{'MB/s':>10}{'change':>10}", file=sys.stderr)
+
+	for result in results:
+		base = baseline.get(get_result_key(result))
+
+		if base is None:
+			continue
+
+		change = (result["mb_s"] - base["mb_s"]) / base["mb_s"] * 100
+		flag = "REGRESSION" if change < -args.threshold else ""
+
+		print(f"{result['tool']:<22}{result['input']:<18}{format_variant(result['variant']):<28}{base['mb_s']:>10.1f}{result['mb_s']:>10.1f}{change:>+9.1f}% {flag}", file=sys.stderr)
+
+		if flag:
+			regressions.append({ "tool": result["tool"], "input": result["input"], "variant": result["variant"], "baseline_mb_s": base["mb_s"], "mb_s": result["mb_s"], "change_percent": round(change, 2) })
+
+	return regressions
+
+def execute_benchmark():
+	results = run_matrix()
+	report = {
+		"meta": {
+			"date": datetime.now(timezone.utc).isoformat(timespec="seconds"),
+			"host": platform.node(),
+			"platform": platform.platform(),
+			"cpu_count": os.cpu_count(),
+			"seed": SEED,
+			"reps": args.reps,
+			"scale": args.scale,
+		},
+		"results": results,
+		"mismatches": verify_outputs(results),
+	}
+
+	if args.baseline:
+		report["regressions"] = compare_baseline(results)
+
+	if args.out:
+		with open(args.out, "w") as file:
+			json.dump(report, file, indent=1)
+	else:
+		json.dump(report, sys.stdout, indent=1)
+
+	for mismatch in report["mismatches"]:
+		print(f"MISMATCH {mismatch['input']} {mismatch['out_key']}: {mismatch['variants']}", file=sys.stderr)
+
+	return 1 if report["mismatches"] or report.get("regressions") else 0
+
+try:
+	parse_args()
+	sys.exit(execute_benchmark())
+
+except Exception as e:
+	print(e)
+	sys.exit(1)
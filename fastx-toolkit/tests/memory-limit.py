@@ -0,0 +1,113 @@
+import argparse
+import os
+import random
+import subprocess
+import sys
+from os import path
+
+# Must match PRIVATE_STATS_LIMIT of fastx-qual-stats-omp
+PRIVATE_STATS_LIMIT_KB = 256 << 10
+
+SEED = 42
+NUM_RECORDS = 16
+SEQ_LEN = 150000
+
+parser = argparse.ArgumentParser(prog="memory-limit.py", description="Checks that fastx-qual-stats-omp keeps per-thread statistics of long reads under its limit", epilog="")
+args = None
+
+def valid_args(args):
+	result = True
+
+	result &= path.isdir(args.bin)
+	result &= path.isdir(args.tmp)
+	result &= args.threads > 1
+
+	if result == False:
+		raise ValueError("Invalid arguments")
+
+def parse_args():
+	global args
+
+	parser.add_argument("-b", "--bin", help="directory of the tool executables", type=str, required=True)
+	parser.add_argument("-t", "--tmp", help="sample and output directory", type=str, required=True)
+	parser.add_argument("--threads", help="thread count compared against one thread. default is 8", type=int, default=8)
+
+	args = parser.parse_args()
+	valid_args(args)
+
+def get_exec(name):
+	exec_path = path.join(args.bin, name + (".exe" if os.name == "nt" else ""))
+
+	if not path.isfile(exec_path):
+		raise ValueError(f"Missing executable: {exec_path}")
+
+	return exec_path
+
+# A few reads long enough that private statistics of every thread would exceed the limit
+def gen_samp():
+	samp_path = path.join(args.tmp, f"long-reads-{NUM_RECORDS}x{SEQ_LEN}.fq")
+	rng = random.Random(SEED)
+
+	with open(samp_path, "w") as file:
+		for i in range(NUM_RECORDS):
+			seq = "".join(rng.choices("ACGTN", k=SEQ_LEN))
+			qual = "".join(chr(33 + rng.randint(0, 40)) for _ in range(SEQ_LEN))
+			file.write(f"@read{i}\n{seq}\n+\n{qual}\n")
+
+	return samp_path
+
+# Runs the command and returns the peak RSS in KiB of the child
+def run_once(command):
+	proc = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+	_, status, usage = os.wait4(proc.pid, 0)
+	error = proc.stderr.read().decode(errors="replace")
+	proc.stderr.close()
+
+	if os.waitstatus_to_exitcode(status) != 0:
+		raise RuntimeError(f"Failed: {' '.join(command)}\n{error}")
+
+	return usage.ru_maxrss // (1024 if sys.platform == "darwin" else 1)
+
+def execute_check():
+	if not hasattr(os, "wait4"):
+		raise RuntimeError("Peak RSS needs os.wait4")
+
+	samp_path = gen_samp()
+	omp = get_exec("fastx-qual-stats-omp")
+	outputs = {}
+	peaks = {}
+	failed = False
+
+	for variant in [ [ "--ths", "1" ], [ "--ths", str(args.threads) ], [ "--ths", str(args.threads), "--agg", "columns" ] ]:
+		key = " ".join(variant)
+		out_path = path.join(args.tmp, "out")
+
+		peaks[key] = run_once([ omp, "--long", "-i", samp_path, "-o", out_path ] + variant)
+
+		with open(out_path, "rb") as file:
+			outputs[key] = file.read()
+
+		os.remove(out_path)
+		print(f"[{key}] peak RSS {peaks[key] // 1024}MB", file=sys.stderr)
+
+	os.remove(samp_path)
+
+	# One thread holds a single store; more threads may add at most the private statistics limit
+	for key, peak in peaks.items():
+		if peak > peaks["--ths 1"] + PRIVATE_STATS_LIMIT_KB:
+			print(f"OVER LIMIT [{key}]: {peak // 1024}MB against {peaks['--ths 1'] // 1024}MB with one thread", file=sys.stderr)
+			failed = True
+
+		if outputs[key] != outputs["--ths 1"]:
+			print(f"MISMATCH [{key}]", file=sys.stderr)
+			failed = True
+
+	return 1 if failed else 0
+
+try:
+	parse_args()
+	sys.exit(execute_check())
+
+except Exception as e:
+	print(e)
+	sys.exit(1)